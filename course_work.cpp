@@ -4,7 +4,35 @@
 #include <queue>
 #include <fstream>
 #include <memory>
+#include <cstring>
 #include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <cctype>
+#include <thread>
+#include <filesystem>
+#include <string_view>
+#include <new>
+#include <utility>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 class Employee;
@@ -16,15 +44,22 @@ class Checkout;
 
 class Order {
 private:
+	unsigned long long id = 0;
 	std::vector<Pizza> pizzas;
 	std::string deliveryAddress;
 	std::string clientName;
+	std::string clientLogin;
 public:
-	std::string getAddress() const;
-	std::string getClientName() const;
+	unsigned long long getId() const;
+	void setId(unsigned long long);
+	const std::string& getAddress() const;
+	const std::string& getClientName() const;
+	const std::string& getClientLogin() const;
 	void setAddress(const std::string&);
 	void setClientName(const std::string&);
+	void setClientLogin(const std::string&);
 	double getOrderPrice() const;
+	const std::vector<Pizza>& getPizzas() const;
 	void addPizza(const std::string& name, double price, int amount = 1);
 };
 
@@ -41,28 +76,790 @@ private:
 	std::vector<std::string> feedbacks;
 public:
 	std::vector<std::string>& getReviews();
+	const std::vector<std::string>& getReviews() const;
 	void receiveFeedback(const std::string& clientName, const std::string& feedback);
 };
 
+// Space-Saving heavy hitter summary. Keeps at most `capacity` counters, so
+// memory is fixed; a reported count overestimates the real one by at most
+// the count of the counter it replaced
+class SpaceSaving {
+private:
+	struct Counter {
+		std::string key;
+		unsigned long long count = 0;
+		unsigned long long error = 0;
+	};
+	std::vector<Counter> counters;
+	size_t capacity;
+public:
+	SpaceSaving(size_t capacity = 32);
+	void add(const std::string& key, unsigned long long weight = 1);
+	void clear();
+	std::vector<std::pair<std::string, unsigned long long>> top(size_t k) const;
+	void save(std::ofstream& out) const;
+	void load(std::ifstream& in);
+};
+
+// Popularity of pizzas and of pizza pairs ordered together, counted per
+// day. Reports merge the current and the previous day
+class PopularityStats {
+private:
+	static constexpr long long kWindowMinutes = 24 * 60;
+	static constexpr size_t kMaxPizzasPerOrder = 8;
+	mutable std::mutex lock;
+	long long windowStart = 0;
+	SpaceSaving pizzas[2];
+	SpaceSaving pairs[2];
+	void rotate(long long now);
+	static long long nowMinutes();
+public:
+	PopularityStats();
+	void recordOrder(const Order& o);
+	std::vector<std::string> mostPopular(size_t k) const;
+	std::vector<std::string> orderedWith(const std::string& pizza, size_t k) const;
+	void save(std::ofstream& out) const;
+	void load(std::ifstream& in);
+};
+
+uint64_t fnv1a(std::string_view s);
+
+enum class OrderStage : uint8_t {
+	Accepted,
+	Deferred,
+	Preparing,
+	Ready,
+	OutForDelivery,
+	Delivered
+};
+
+const char* stageName(OrderStage stage);
+
+struct OrderEvent {
+	uint64_t orderId = 0;
+	uint64_t loginHash = 0;
+	int64_t timeMs = 0;
+	OrderStage stage = OrderStage::Accepted;
+};
+
+class OrderStatusBus;
+
+// Cursor of one watcher into the bus; sees events from its starting
+// position on that match its order ID or client login
+class StatusSubscription {
+private:
+	const OrderStatusBus* bus;
+	uint64_t cursor;
+	uint64_t orderId;
+	uint64_t loginHash;
+	unsigned long long missed = 0;
+	bool matches(const OrderEvent& e) const;
+public:
+	StatusSubscription(const OrderStatusBus* bus, uint64_t cursor, uint64_t orderId, uint64_t loginHash);
+	bool tryNext(OrderEvent& e);
+	void next(OrderEvent& e);
+	unsigned long long getMissed() const;
+};
+
+// Broadcast ring of order stage changes. Publishers claim a slot with one
+// fetch_add and guard it with a per-slot sequence (a seqlock), watchers
+// read without locks or writes to shared state and sleep on the slot they
+// wait for. A watcher that is lapped skips ahead and counts what it missed
+class OrderStatusBus {
+public:
+	static constexpr size_t kSlots = 8192;
+private:
+	static constexpr size_t kWords = 4;
+	struct Slot {
+		std::atomic<uint64_t> seq = 0;
+		std::atomic<uint64_t> words[kWords] = {};
+	};
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<uint64_t> next = 0;
+	friend class StatusSubscription;
+	enum class ReadResult { Ok, Empty, Overrun };
+	ReadResult read(uint64_t index, OrderEvent& e) const;
+public:
+	OrderStatusBus();
+	void publish(const Order& o, OrderStage stage);
+	uint64_t position() const;
+	StatusSubscription subscribeOrder(unsigned long long orderId, uint64_t from) const;
+	StatusSubscription subscribeClient(const std::string& login) const;
+};
+
+// Position in kilometres relative to the pizzeria
+struct GeoPoint {
+	double x = 0;
+	double y = 0;
+};
+
+GeoPoint locateAddress(const std::string& address);
+double distanceKm(const GeoPoint& a, const GeoPoint& b);
+
+// One courier run: leaves the pizzeria, visits the stops in order, returns.
+// soloKm and soloMinutes are what the stops would cost one trip each
+struct DeliveryTrip {
+	std::vector<Order> stops;
+	double km = 0;
+	double minutes = 0;
+	double soloKm = 0;
+	double soloMinutes = 0;
+};
+
+// Collects ready orders and plans multi-stop trips: nearby addresses are
+// grouped up to tripCapacity orders, each group is routed with nearest
+// neighbour plus 2-opt, and a stop is moved to another trip if it would be
+// reached later than promiseMinutes after the order became ready. Ready
+// orders are held until a full trip is waiting, the oldest has waited
+// windowMinutes or one of them is running out of slack, so there is
+// something to batch. A minute lasts millisPerMinute milliseconds, which
+// lets the planner run on the kitchen's simulated clock. Statistics only
+// count the trips a courier actually took
+class DeliveryPlanner {
+private:
+	static constexpr double kSpeedKmh = 25;
+	static constexpr double kMinutesPerStop = 3;
+	static constexpr double kGroupRadiusKm = 2.5;
+	mutable std::mutex lock;
+	size_t tripCapacity;
+	double promiseMinutes;
+	double windowMinutes;
+	double millisPerMinute;
+	std::vector<Order> ready;
+	std::unordered_map<unsigned long long, std::chrono::steady_clock::time_point> readySince;
+	std::chrono::steady_clock::time_point heldUntil;
+	unsigned long long ordersPlanned = 0;
+	unsigned long long tripsPlanned = 0;
+	double plannedKm = 0;
+	double plannedMinutes = 0;
+	double baselineKm = 0;
+	double baselineMinutes = 0;
+	unsigned long long tripsWaiting = 0;
+	// Courier -> orders delivered and kilometres driven since the start
+	std::unordered_map<std::string, std::pair<unsigned long long, double>> byCourier;
+	std::vector<size_t> route(const std::vector<GeoPoint>& points) const;
+	double arrivals(const std::vector<GeoPoint>& points, const std::vector<double>& waited, const std::vector<size_t>& order, double& km) const;
+	double minutesWaited(const Order& o, std::chrono::steady_clock::time_point now) const;
+	double dueInMinutes(std::chrono::steady_clock::time_point now) const;
+public:
+	DeliveryPlanner(size_t tripCapacity = 4, double promiseMinutes = 45, double windowMinutes = 10, double millisPerMinute = 60000);
+	size_t getTripCapacity() const;
+	std::chrono::milliseconds untilDue() const;
+	void addReady(const Order& o);
+	std::vector<DeliveryTrip> plan(bool flush = false);
+	void dispatched(const DeliveryTrip& trip, const std::string& courier);
+	void putBack(const DeliveryTrip& trip);
+	void printReport() const;
+	void save(std::ofstream& out) const;
+	void load(std::ifstream& in);
+};
+
+enum class AdmissionDecision : uint8_t {
+	Accept,
+	Defer,
+	Reject,
+	Declined
+};
+
+const char* decisionName(AdmissionDecision d);
+
+// startMinutes is how long a deferred order is held before the kitchen starts
+// it. overBudget marks an order accepted past the budget because it is
+// alone in the kitchen, holding it back would not make it faster
+struct AdmissionQuote {
+	AdmissionDecision decision = AdmissionDecision::Accept;
+	bool overBudget = false;
+	double waitMinutes = 0;
+	double startMinutes = 0;
+	size_t queuedOrders = 0;
+	size_t makers = 0;
+	size_t couriers = 0;
+};
+
+// Estimates how long a new order would take from the kitchen queue, the
+// roster and the service time estimates, and admits it only within the
+// latency budget. Orders up to deferBudgetMinutes are deferred: they are held
+// behind the accepted and earlier deferred work until the kitchen has room
+// again, slower ones are rejected. The pipeline model's rate is scaled by
+// how long accepted orders really took to get ready. Every decision is
+// appended to a CSV log
+class AdmissionController {
+private:
+	static constexpr double kSmoothing = 0.2;
+	mutable std::mutex lock;
+	double budgetMinutes = 60;
+	double deferBudgetMinutes = 90;
+	double minutesPerPizza = 4;  // whole kitchen, from the pipeline model
+	double minutesPerTrip = 25;
+	double measuredScale = 1;  // measured Accepted->Ready time over the model's
+	std::string logPath;
+public:
+	AdmissionController(const std::string& logPath = "AdmissionLog.csv");
+	AdmissionQuote quote(size_t queuedOrders, size_t acceptedPizzas, size_t deferredPizzas, size_t orderPizzas, size_t makers, size_t couriers, size_t tripCapacity) const;
+	void record(const Order& o, const AdmissionQuote& q) const;
+	void setKitchenRate(double minutesPerPizza);
+	void observeKitchen(double minutes, size_t pizzas);
+	void notePlannedTrip(double minutes);
+	void setBudgets(double budgetMinutes, double deferBudgetMinutes);
+	void printSettings() const;
+	void save(std::ofstream& out) const;
+	void load(std::ifstream& in);
+};
+
+// Blocking queue with a fixed capacity. push waits while it is full, which
+// is how a slow consumer slows its producers down
+template <class T>
+class BoundedQueue {
+private:
+	mutable std::mutex lock;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+	std::deque<T> items;
+	size_t capacity;
+	bool closed = false;
+public:
+	BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+	// Returns the queue length after the push, or 0 if the queue was closed
+	size_t push(T item) {
+		std::unique_lock<std::mutex> guard(lock);
+		notFull.wait(guard, [this] { return closed or items.size() < capacity; });
+		if (closed) return 0;
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+		return items.size();
+	}
+
+	// Returns false once the queue is closed and empty
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> guard(lock);
+		notEmpty.wait(guard, [this] { return closed or !items.empty(); });
+		if (items.empty()) return false;
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	bool full() const {
+		std::lock_guard<std::mutex> guard(lock);
+		return items.size() >= capacity;
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> guard(lock);
+		closed = true;
+		notEmpty.notify_all();
+		notFull.notify_all();
+	}
+};
+
+struct KitchenStation {
+	std::string name;
+	double minutesPerPizza;
+	bool manned;
+	size_t slots;
+	size_t queueCapacity;
+};
+
+// Simulation of the kitchen as a chain of stations (dough, toppings, oven,
+// boxing, dispatch). Each station has its own workers and a bounded queue in
+// front of it, so orders overlap across stations and a slow station holds
+// back the ones before it. Every station has a fixed number of slots; manned
+// ones give them to the pizza makers on shift, a maker covering several
+// stations works at one of them at a time. Each slot is a thread of a pool
+// started with the first run and kept for the next ones. Station work is a
+// sleep of kMillisPerMinute milliseconds per kitchen minute, so the
+// statistics show how the model behaves under load, not measured cooking
+// times
+class KitchenPipeline {
+public:
+	using Callback = std::function<void(const Order&)>;
+	using Source = std::function<bool(Order&)>;
+	static constexpr double kMillisPerMinute = 5;
+private:
+	struct StationStats {
+		std::atomic<uint64_t> orders = 0;
+		std::atomic<uint64_t> pizzas = 0;
+		std::atomic<uint64_t> busyUs = 0;
+		std::atomic<uint64_t> blockedUs = 0;
+		std::atomic<uint64_t> queueSamples = 0;
+		std::atomic<uint64_t> queueFill = 0;
+		uint64_t workerUs = 0;
+	};
+	mutable std::mutex lock;
+	std::vector<KitchenStation> stations;
+	std::unique_ptr<StationStats[]> stats;
+	uint64_t wallUs = 0;
+	// Maker -> station jobs and busy time since the start
+	std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> byMaker;
+	// Slot threads; each run hands them a job and waits until all are done
+	std::vector<std::thread> pool;
+	std::mutex poolLock;
+	std::condition_variable poolWake;
+	std::condition_variable poolDone;
+	std::function<void(size_t station, size_t slot)> job;
+	uint64_t generation = 0;
+	size_t active = 0;
+	bool stopping = false;
+	void slotLoop(size_t station, size_t slot);
+public:
+	KitchenPipeline();
+	~KitchenPipeline();
+	void run(Source next, const std::vector<PizzaMaker>& crew, Callback onStart, Callback onDone);
+	size_t maxCrew() const;
+	double minutesPerPizza(size_t makers) const;
+	void printReport() const;
+	void save(std::ofstream& out) const;
+	void load(std::ifstream& in);
+};
+
+// Empty fields mean "not known here", a password is never empty
+struct ClientRecord {
+	std::string password;
+	std::string address;
+};
+
+// Clients kept on disk in ClientIndex.bin: records sorted by login, cut into
+// blocks of kBlockRecords, followed by a sparse index holding the first login
+// of every block. Only the sparse index lives in memory and a lookup reads a
+// single block. Not thread-safe, every user keeps its own handle
+struct ClientIndexFile {
+	static constexpr size_t kBlockRecords = 64;
+	std::ifstream in;
+	std::vector<std::pair<std::string, long long>> blocks;
+	size_t count = 0;
+	bool open(const std::string& path);
+	void close();
+	bool find(const std::string& login, ClientRecord& rec);
+};
+
+// Read-only handle on the index file with its own lock, so lookups from
+// another thread do not queue behind the index owner. The owner swaps the
+// file under it after every merge and bumps the generation
+class ClientIndexReader {
+private:
+	friend class ClientIndex;
+	mutable std::mutex lock;
+	mutable ClientIndexFile file;
+	std::atomic<unsigned long long> generation = 0;
+public:
+	bool find(const std::string& login, ClientRecord& rec) const;
+	unsigned long long getGeneration() const;
+};
+
+// The index file plus sign-ups and address changes, which go to an
+// in-memory delta and are merged into a new file in the background once it
+// grows
+class ClientIndex {
+private:
+	static constexpr size_t kMergeThreshold = 1024;
+	std::string path;
+	mutable std::mutex lock;
+	mutable ClientIndexFile file;
+	unsigned long long generation = 0;
+	mutable std::vector<std::weak_ptr<ClientIndexReader>> readers;
+	std::unordered_map<std::string, ClientRecord> delta;
+	std::unordered_map<std::string, ClientRecord> merging;
+	std::thread merger;
+	bool findLocked(const std::string& login, ClientRecord& rec) const;
+	void put(const std::string& login, const ClientRecord& rec);
+	void runMerge();
+public:
+	ClientIndex(const std::string& path = "ClientIndex.bin");
+	~ClientIndex();
+	bool open();
+	void build(const std::unordered_map<std::string, std::string>& logins, const std::unordered_map<std::string, std::string>& addresses);
+	bool find(const std::string& login, ClientRecord& rec) const;
+	std::shared_ptr<ClientIndexReader> openReader() const;
+	void setPassword(const std::string& login, const std::string& password);
+	void setAddress(const std::string& login, const std::string& address);
+	void merge();
+	std::unordered_map<std::string, ClientRecord> pendingChanges() const;
+};
+
+enum class MutationType : unsigned char {
+	AddClient,
+	SaveAddress,
+	AddPizza,
+	DeletePizza,
+	AddPizzaMaker,
+	AddCourier,
+	DeletePizzaMaker,
+	DeleteCourier,
+	AddReview,
+	SetAdminKey
+};
+
+// One change of the primary DB, numbered in the order it was applied
+struct Mutation {
+	unsigned long long seq = 0;
+	MutationType type = MutationType::AddClient;
+	std::string key;
+	std::string value;
+	double price = 0;
+};
+
+std::string encodeMutation(const Mutation& m);
+bool decodeMutation(const std::string& buf, size_t& pos, Mutation& m);
+
+// Full copy of the primary state, used by replicas to (re)start
+struct DBSnapshot {
+	unsigned long long seq = 0;
+	std::string AdminKey;
+	std::vector<Pizza> availablePizzas;
+	std::vector<std::string> pizzaMakers;
+	std::vector<std::string> couriers;
+	std::unordered_map<std::string, ClientRecord> clients;
+	std::vector<std::string> reviews;
+};
+
+// Bounded log of the latest mutations; older records are dropped and
+// replicas that need them have to restart from a snapshot
+class ReplicationJournal {
+private:
+	mutable std::mutex lock;
+	std::deque<std::string> records;
+	unsigned long long lastSeq = 0;
+	size_t capacity;
+public:
+	ReplicationJournal(size_t capacity = 4096);
+	unsigned long long append(Mutation m);
+	unsigned long long getLastSeq() const;
+	bool readSince(unsigned long long seq, std::string& stream) const;
+};
+
+template <class T>
+class VersionedSnapshot;
+
+// Read handle on one version of a VersionedSnapshot. While it lives, its
+// hazard slot keeps that version from being freed
+template <class T>
+class SnapshotReader {
+private:
+	friend class VersionedSnapshot<T>;
+	std::atomic<const void*>* hazard = nullptr;
+	const T* value = nullptr;
+	unsigned long long number = 0;
+	SnapshotReader(std::atomic<const void*>* hazard, const T* value, unsigned long long number)
+		: hazard(hazard), value(value), number(number) {}
+	void release() {
+		if (hazard) hazard->store(nullptr, std::memory_order_release);
+		hazard = nullptr;
+	}
+public:
+	SnapshotReader(const SnapshotReader&) = delete;
+	SnapshotReader& operator=(const SnapshotReader&) = delete;
+	SnapshotReader(SnapshotReader&& other) noexcept
+		: hazard(std::exchange(other.hazard, nullptr)), value(other.value), number(other.number) {}
+	SnapshotReader& operator=(SnapshotReader&& other) noexcept {
+		if (this != &other) {
+			release();
+			hazard = std::exchange(other.hazard, nullptr);
+			value = other.value;
+			number = other.number;
+		}
+		return *this;
+	}
+	~SnapshotReader() {
+		release();
+	}
+	const T& operator*() const { return *value; }
+	const T* operator->() const { return value; }
+	unsigned long long version() const { return number; }
+};
+
+// Immutable versioned value with lock-free, allocation-free reads. The
+// current version is a raw atomic pointer; a reader claims one of kReaders
+// hazard slots, publishes the version it is about to use there and checks
+// that it is still current. Writers copy, edit and swap the pointer under a
+// mutex, then free the retired versions no hazard slot points at
+template <class T>
+class VersionedSnapshot {
+public:
+	static constexpr size_t kReaders = 64;
+private:
+	struct Version {
+		unsigned long long number = 0;
+		T value;
+	};
+	std::atomic<const Version*> current;
+	mutable std::atomic<const void*> hazards[kReaders] = {};
+	std::mutex writeLock;
+	std::vector<const Version*> retired;
+
+	void reclaim() {
+		std::erase_if(retired, [this](const Version* v) {
+			for (const auto& slot : hazards) {
+				if (slot.load(std::memory_order_seq_cst) == v) return false;
+			}
+			delete v;
+			return true;
+		});
+	}
+public:
+	VersionedSnapshot() : current(new Version()) {}
+	VersionedSnapshot(const VersionedSnapshot&) = delete;
+	VersionedSnapshot& operator=(const VersionedSnapshot&) = delete;
+	~VersionedSnapshot() {
+		for (const Version* v : retired) {
+			delete v;
+		}
+		delete current.load();
+	}
+
+	// A claimed slot holds its own address until a version is published in
+	// it, so free slots are exactly the null ones. Only yields if all
+	// kReaders slots are held at once
+	SnapshotReader<T> load() const {
+		size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+		for (size_t i = 0;; ++i) {
+			std::atomic<const void*>& slot = hazards[(start + i) % kReaders];
+			const void* expected = nullptr;
+			if (slot.load(std::memory_order_relaxed) == nullptr
+				and slot.compare_exchange_strong(expected, &slot, std::memory_order_acquire)) {
+				const Version* v = current.load(std::memory_order_seq_cst);
+				while (true) {
+					slot.store(v, std::memory_order_seq_cst);
+					const Version* again = current.load(std::memory_order_seq_cst);
+					if (again == v) break;
+					v = again;
+				}
+				return SnapshotReader<T>(&slot, &v->value, v->number);
+			}
+			if (i % kReaders == kReaders - 1) std::this_thread::yield();
+		}
+	}
+
+	unsigned long long version() const {
+		return load().version();
+	}
+
+	template <class F>
+	auto update(F edit) {
+		std::lock_guard<std::mutex> guard(writeLock);
+		const Version* old = current.load(std::memory_order_relaxed);
+		Version* next = new Version(*old);
+		++next->number;
+		auto result = edit(next->value);
+		current.store(next, std::memory_order_seq_cst);
+		retired.push_back(old);
+		reclaim();
+		return result;
+	}
+
+	void publish(T value) {
+		update([&value](T& v) { v = std::move(value); return true; });
+	}
+};
+
+// Roster of one role. Every employee gets a stable ID and a name index;
+// idle workers are tracked in a two-level bitmap, so claiming one is a
+// find-first-set plus an atomic bit clear and releasing it is one bit set
+template <class T>
+class EmployeeRegistry {
+public:
+	static constexpr size_t kWordBits = 64;
+	static constexpr size_t kCapacity = kWordBits * kWordBits;
+	static constexpr size_t npos = (size_t)-1;
+private:
+	mutable std::mutex writeLock;
+	std::vector<T> slots;
+	std::vector<size_t> freeIds;
+	std::unordered_multimap<std::string, size_t> index;
+	VersionedSnapshot<std::vector<T>> roster;
+	std::atomic<uint64_t> hired[kWordBits] = {};
+	std::atomic<uint64_t> idle[kWordBits] = {};
+	std::atomic<uint64_t> idleSummary = 0;
+
+	static uint64_t bitOf(size_t id) {
+		return uint64_t(1) << (id % kWordBits);
+	}
+
+	// Summary bits are only a hint, so a cleared bit is restored if a
+	// worker was released into the word meanwhile
+	void dropSummaryBit(size_t w) {
+		idleSummary.fetch_and(~(uint64_t(1) << w), std::memory_order_acq_rel);
+		if (idle[w].load(std::memory_order_acquire) != 0)
+			idleSummary.fetch_or(uint64_t(1) << w, std::memory_order_acq_rel);
+	}
+
+	// Frees the ID of a worker that was removed while busy
+	void retire(size_t id) {
+		std::lock_guard<std::mutex> guard(writeLock);
+		if (id < slots.size() and !(hired[id / kWordBits].load(std::memory_order_acquire) & bitOf(id)))
+			freeIds.push_back(id);
+	}
+
+	size_t hireLocked(const std::string& name) {
+		size_t id;
+		if (!freeIds.empty()) {
+			id = freeIds.back();
+			freeIds.pop_back();
+			slots[id] = T();
+		}
+		else if (slots.size() < kCapacity) {
+			id = slots.size();
+			slots.emplace_back();
+		}
+		else return npos;
+		slots[id].setName(name);
+		index.emplace(name, id);
+		hired[id / kWordBits].fetch_or(bitOf(id), std::memory_order_release);
+		release(id);
+		return id;
+	}
+public:
+	size_t add(const std::string& name) {
+		std::lock_guard<std::mutex> guard(writeLock);
+		size_t id = hireLocked(name);
+		if (id != npos) roster.update([this, id](std::vector<T>& v) { v.push_back(slots[id]); return true; });
+		return id;
+	}
+
+	// Replaces the whole roster, used when loading the DB
+	void load(const std::vector<T>& employees) {
+		std::lock_guard<std::mutex> guard(writeLock);
+		for (size_t w = 0; w < kWordBits; ++w) {
+			hired[w].store(0);
+			idle[w].store(0);
+		}
+		idleSummary.store(0);
+		slots.clear();
+		freeIds.clear();
+		index.clear();
+		std::vector<T> listed;
+		for (const T& e : employees) {
+			if (hireLocked(e.getName()) != npos) listed.push_back(e);
+		}
+		roster.publish(std::move(listed));
+	}
+
+	// Removes every employee with this name. A worker that is busy right now
+	// keeps its ID retired until its release(), so that call cannot wake a
+	// new hire
+	size_t remove(const std::string& name) {
+		std::lock_guard<std::mutex> guard(writeLock);
+		auto range = index.equal_range(name);
+		size_t removed = 0;
+		for (auto it = range.first; it != range.second; ++it) {
+			size_t id = it->second;
+			size_t w = id / kWordBits;
+			hired[w].fetch_and(~bitOf(id), std::memory_order_acq_rel);
+			uint64_t was = idle[w].fetch_and(~bitOf(id), std::memory_order_acq_rel);
+			if (was & bitOf(id)) freeIds.push_back(id);
+			++removed;
+		}
+		index.erase(name);
+		if (removed != 0) roster.update([&name](std::vector<T>& v) {
+			return std::erase_if(v, [&name](T& e) { return e.getName() == name; });
+		});
+		return removed;
+	}
+
+	// Claims an idle worker and returns its ID, or npos if everyone is busy
+	size_t acquire() {
+		uint64_t summary = idleSummary.load(std::memory_order_acquire);
+		while (summary != 0) {
+			size_t w = std::countr_zero(summary);
+			uint64_t word = idle[w].load(std::memory_order_acquire);
+			while (word != 0) {
+				uint64_t bit = word & (~word + 1);
+				if (idle[w].compare_exchange_weak(word, word & ~bit, std::memory_order_acq_rel)) {
+					if ((word & ~bit) == 0) dropSummaryBit(w);
+					return w * kWordBits + std::countr_zero(bit);
+				}
+			}
+			dropSummaryBit(w);
+			summary &= ~(uint64_t(1) << w);
+		}
+		return npos;
+	}
+
+	void release(size_t id) {
+		size_t w = id / kWordBits;
+		if (!(hired[w].load(std::memory_order_acquire) & bitOf(id))) {
+			retire(id);
+			return;
+		}
+		idle[w].fetch_or(bitOf(id), std::memory_order_acq_rel);
+		idleSummary.fetch_or(uint64_t(1) << w, std::memory_order_acq_rel);
+		// Removed meanwhile: if remove() did not see the idle bit, the ID is ours to free
+		if (!(hired[w].load(std::memory_order_acquire) & bitOf(id))) {
+			uint64_t was = idle[w].fetch_and(~bitOf(id), std::memory_order_acq_rel);
+			if (was & bitOf(id)) retire(id);
+		}
+	}
+
+	T get(size_t id) const {
+		std::lock_guard<std::mutex> guard(writeLock);
+		return slots[id];
+	}
+
+	size_t find(const std::string& name) const {
+		std::lock_guard<std::mutex> guard(writeLock);
+		auto it = index.find(name);
+		return it == index.end() ? npos : it->second;
+	}
+
+	size_t idleCount() const {
+		size_t n = 0;
+		for (size_t w = 0; w < kWordBits; ++w) {
+			n += std::popcount(idle[w].load(std::memory_order_relaxed));
+		}
+		return n;
+	}
+
+	SnapshotReader<std::vector<T>> list() const {
+		return roster.load();
+	}
+};
+
 class PizzeriaDB {
 private:
+	ReplicationJournal journal;
 	std::string AdminKey = "superadmin";
-	std::vector<Pizza> availablePizzas;
-	std::vector<PizzaMaker> pizzaMakers;
-	std::vector<DeliveryMan> couriers;
-	std::unordered_map<std::string, std::string> clientLogins;
-	std::unordered_map<std::string, std::string> clientAddresses;
+	VersionedSnapshot<std::vector<Pizza>> availablePizzas;
+	EmployeeRegistry<PizzaMaker> pizzaMakers;
+	EmployeeRegistry<DeliveryMan> couriers;
+	ClientIndex clients;
 	std::queue<Order> current_orders;
+	std::queue<Order> deferred_orders;
+	mutable std::mutex ordersLock;
+	std::condition_variable ordersChanged;
+	std::thread kitchenThread;
+	bool kitchenBusy = false;
+	bool stopping = false;
+	std::atomic<size_t> acceptedPizzas = 0;
+	std::atomic<size_t> deferredPizzas = 0;
+	// Accepted order ID -> when it entered the kitchen queue and the pizzas
+	// its quote had it wait for
+	std::unordered_map<unsigned long long, std::pair<std::chrono::steady_clock::time_point, size_t>> admitted;
+	AdmissionController admission;
+	KitchenPipeline kitchen;
 	Checkout kassa;
 	FeedbackSystem feedbackReceiver;
+	PopularityStats popularity;
+	DeliveryPlanner planner{ 4, 45, 10, KitchenPipeline::kMillisPerMinute };
+	OrderStatusBus statusBus;
+	std::atomic<unsigned long long> lastOrderId = 0;
+	void migrateLegacyClients();
+	void admit(const Order& o);
+	void promoteDeferred();
+	bool nextOrder(Order& o);
+	void kitchenLoop();
+	void finishOrders();
+	void updateKitchenRate();
+	void dispatchDeliveries(bool flush);
 public:
+	~PizzeriaDB();
 	std::string getClientAddress(const std::string&);
 	void saveAddress(const std::string&, const std::string&);
 	void readFeedbacks();
-	std::vector<Pizza> getPizzasAvailable() const;
+	SnapshotReader<std::vector<Pizza>> getPizzasAvailable() const;
 	void addClient(const std::string&, const std::string&);
-	std::vector<PizzaMaker> getPizzaMakers();
-	std::vector<DeliveryMan> getCouriers();
+	SnapshotReader<std::vector<PizzaMaker>> getPizzaMakers() const;
+	SnapshotReader<std::vector<DeliveryMan>> getCouriers() const;
 	void addEmployee(const std::string& name);
 	void deleteEmployee(const std::string& s);
 	void addPizza(const std::string& name, double price);
@@ -70,12 +867,61 @@ public:
 	void setAdminKey(const std::string& s);
 	bool AdminIsValid(const std::string&) const;
 	bool ClientIsValid(const std::string&, const std::string&) const;
-	void newOrder(const Order& o);
+	AdmissionQuote quoteOrder(const Order& o) const;
+	void declineOrder(const Order& o, AdmissionQuote q);
+	unsigned long long newOrder(Order o, const AdmissionQuote& confirmed);
 	void complete_order();
 	void getDB();
 	void saveDB();
 	void paymentProcess(const Order&);
 	void getFeedback(const std::string&);
+	const ReplicationJournal& getJournal() const;
+	const ClientIndex& getClientIndex() const;
+	DBSnapshot takeSnapshot() const;
+	std::vector<std::string> getPopularPizzas(size_t k) const;
+	std::vector<std::string> getOrderedWith(const std::string& pizza, size_t k) const;
+	void printDeliveryReport() const;
+	void printKitchenReport() const;
+	const OrderStatusBus& getStatusBus() const;
+	void printAdmissionSettings() const;
+	void setAdmissionBudgets(double budgetMinutes, double deferBudgetMinutes);
+};
+
+// Read-only copy of the DB fed by the primary journal. Reads are served
+// locally and resync once the replica falls more than maxLag records behind,
+// or has been behind at all for longer than maxDelay. The menu is only
+// resynced by a background thread, so menu reads never take the lock
+class PizzeriaReplica {
+private:
+	std::shared_ptr<const PizzeriaDB> primary;
+	mutable std::mutex lock;
+	DBSnapshot state;
+	VersionedSnapshot<std::vector<Pizza>> catalogue;
+	unsigned long long maxLag;
+	std::chrono::milliseconds maxDelay;
+	std::chrono::steady_clock::time_point lastSync;
+	unsigned long long snapshotReloads = 0;
+	std::shared_ptr<ClientIndexReader> clientFile;
+	unsigned long long clientFileGeneration = 0;
+	std::condition_variable wake;
+	bool stopping = false;
+	std::thread syncer;
+	void apply(const Mutation& m);
+	void catchUp();
+	void syncIfStale();
+	void syncLoop();
+	void trimClients();
+	bool findClient(const std::string& login, ClientRecord& rec) const;
+public:
+	PizzeriaReplica(std::shared_ptr<const PizzeriaDB> primary, unsigned long long maxLag = 16, std::chrono::milliseconds maxDelay = std::chrono::seconds(2));
+	~PizzeriaReplica();
+	unsigned long long getAppliedSeq() const;
+	unsigned long long getSnapshotReloads() const;
+	unsigned long long getLag() const;
+	SnapshotReader<std::vector<Pizza>> getPizzasAvailable() const;
+	void readFeedbacks();
+	bool ClientIsValid(const std::string&, const std::string&);
+	std::string getClientAddress(const std::string&);
 };
 
 class Employee {
@@ -91,8 +937,6 @@ public:
 };
 
 class PizzaMaker : public Employee {
-public:
-	void makePizza(const Order&);
 };
 
 class DeliveryMan : public Employee {
@@ -116,6 +960,111 @@ public:
 	unsigned int getAmount() const;
 };
 
+// Binary order encoding that is read in place. Layout (version 2, native
+// little-endian, 8-byte aligned): OrderWireHeader, pizzaCount OrderWirePizza
+// entries, then the raw bytes of all strings. Version 2 added the order ID
+// and the client login
+struct OrderWireHeader {
+	static constexpr uint32_t kMagic = 0x524f5a50; // "PZOR"
+	static constexpr uint16_t kVersion = 2;
+	uint32_t magic;
+	uint16_t version;
+	uint16_t pizzaCount;
+	uint32_t totalSize;
+	uint32_t clientNameOffset;
+	uint32_t clientNameLen;
+	uint32_t addressOffset;
+	uint32_t addressLen;
+	uint32_t clientLoginOffset;
+	uint32_t clientLoginLen;
+	uint32_t reserved;
+	uint64_t id;
+};
+
+static_assert(sizeof(OrderWireHeader) == 48);
+
+struct OrderWirePizza {
+	double price;
+	uint32_t amount;
+	uint32_t nameOffset;
+	uint32_t nameLen;
+	uint32_t reserved;
+};
+
+size_t orderWireSize(const Order& o);
+size_t encodeOrder(const Order& o, char* dst, size_t capacity);
+
+// Non-owning view over an encoded order; nothing is copied or allocated
+class OrderView {
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+	OrderWireHeader header() const;
+	OrderWirePizza pizza(size_t i) const;
+public:
+	OrderView() = default;
+	OrderView(const char* data, size_t size);
+	bool isValid() const;
+	unsigned long long getId() const;
+	std::string_view getClientLogin() const;
+	std::string_view getClientName() const;
+	std::string_view getAddress() const;
+	double getOrderPrice() const;
+	size_t getPizzaCount() const;
+	std::string_view getPizzaType(size_t i) const;
+	double getPizzaPrice(size_t i) const;
+	unsigned int getPizzaAmount(size_t i) const;
+};
+
+// Single-producer single-consumer ring of encoded orders. It only uses the
+// memory it is placed in, so it works inside a mapping shared by two
+// processes. Messages never wrap, the consumer always sees one contiguous
+// buffer
+class OrderRing {
+private:
+	static constexpr uint32_t kWrapMarker = 0xffffffff;
+	// Each side keeps its own copy of the other index and rereads the shared
+	// one only when the copy says the ring is full or empty
+	alignas(64) std::atomic<uint64_t> head;
+	uint64_t cachedTail;
+	alignas(64) std::atomic<uint64_t> tail;
+	uint64_t cachedHead;
+	alignas(64) uint64_t capacity;
+	char* buffer();
+	static size_t padded(size_t n);
+	bool holds(size_t wireSize, size_t pizzaCount) const;
+public:
+	static_assert(std::atomic<uint64_t>::is_always_lock_free);
+	static size_t requiredBytes(size_t capacity);
+	static OrderRing* create(void* memory, size_t capacity);
+	static OrderRing* attach(void* memory);
+	bool fits(const Order& o) const;
+	bool push(const Order& o);
+	OrderView peek();
+	void pop();
+};
+
+// Named memory region shared between processes
+class SharedRegion {
+private:
+	void* memory = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE mapping = nullptr;
+#else
+	std::string name;
+	bool owner = false;
+#endif
+public:
+	SharedRegion(const std::string& name, size_t size, bool create);
+	~SharedRegion();
+	SharedRegion(const SharedRegion&) = delete;
+	SharedRegion& operator=(const SharedRegion&) = delete;
+	void* get() const;
+};
+
+void benchmarkOrderWire(int iterations);
+
 class User {
 public:
 	virtual void MainMenu(std::shared_ptr<PizzeriaDB> db) = 0;
@@ -125,9 +1074,14 @@ class Client : public User {
 private:
 	std::string savedAddress = "Unknown";
 	std::string login;
+	std::shared_ptr<PizzeriaReplica> replica;
+	std::unique_ptr<StatusSubscription> status;
+	unsigned long long missedShown = 0;
+	void printStatusUpdates(unsigned long long skipOrder = 0);
+	void waitForDelivery(std::shared_ptr<PizzeriaDB> p, unsigned long long orderId, uint64_t from);
 public:
-	Client() = default;
-	Client(std::string l, std::string s) : login(l), savedAddress(s) {}
+	Client(std::shared_ptr<PizzeriaReplica> r) : replica(r) {}
+	Client(std::string l, std::string s, std::shared_ptr<PizzeriaReplica> r) : login(l), savedAddress(s), replica(r) {}
 	std::string getAddress();
 	void setAddress(const std::string&);
 	void makeOrder(std::shared_ptr<PizzeriaDB> p);
@@ -135,7 +1089,10 @@ public:
 };
 
 class Admin : public User {
+private:
+	std::shared_ptr<PizzeriaReplica> replica;
 public:
+	Admin(std::shared_ptr<PizzeriaReplica> r) : replica(r) {}
 	virtual void MainMenu(std::shared_ptr<PizzeriaDB> db) override;
 };
 
@@ -143,24 +1100,45 @@ public:
 
 int inputInt(const std::string& prompt, int m = 1, int M = 1000);
 
-std::shared_ptr<User> authorisation(std::shared_ptr<PizzeriaDB>);
+std::shared_ptr<User> authorisation(std::shared_ptr<PizzeriaDB>, std::shared_ptr<PizzeriaReplica>);
 
 
 
-int main()
+int main(int argc, char* argv[])
 {
+	if (argc > 1 and std::string(argv[1]) == "--bench-wire") {
+		benchmarkOrderWire(argc > 2 ? std::stoi(argv[2]) : 1000000);
+		return 0;
+	}
 	std::shared_ptr<PizzeriaDB> dodo = std::make_shared<PizzeriaDB>();
 	dodo->getDB();
-	std::shared_ptr<User> current_user = authorisation(dodo);
+	std::shared_ptr<PizzeriaReplica> replica = std::make_shared<PizzeriaReplica>(dodo);
+	std::shared_ptr<User> current_user = authorisation(dodo, replica);
 	current_user->MainMenu(dodo);
 	dodo->saveDB();
 }
 
-std::string Order::getAddress() const {
+unsigned long long Order::getId() const {
+	return id;
+}
+
+void Order::setId(unsigned long long i) {
+	id = i;
+}
+
+const std::string& Order::getClientLogin() const {
+	return clientLogin;
+}
+
+void Order::setClientLogin(const std::string& s) {
+	clientLogin = s;
+}
+
+const std::string& Order::getAddress() const {
 	return deliveryAddress;
 }
 
-std::string Order::getClientName() const {
+const std::string& Order::getClientName() const {
 	return clientName;
 }
 
@@ -180,134 +1158,705 @@ double Order::getOrderPrice() const {
 	return sum;
 }
 
+const std::vector<Pizza>& Order::getPizzas() const {
+	return pizzas;
+}
+
 void Order::addPizza(const std::string& name, double price, int amount) {
 	pizzas.emplace_back(name, price, amount);
 }
 
-void PizzeriaDB::readFeedbacks() {
-	for (auto now : feedbackReceiver.getReviews()) {
-		std::cout << now << std::endl;
+size_t orderWireSize(const Order& o) {
+	size_t size = sizeof(OrderWireHeader) + o.getPizzas().size() * sizeof(OrderWirePizza);
+	size += o.getClientLogin().size() + o.getClientName().size() + o.getAddress().size();
+	for (const Pizza& p : o.getPizzas()) {
+		size += p.getPizzaType().size();
 	}
+	return size;
 }
 
-std::vector<std::string>& FeedbackSystem::getReviews() {
-	return feedbacks;
+// Returns the number of bytes written, or 0 if the order does not fit
+size_t encodeOrder(const Order& o, char* dst, size_t capacity) {
+	const std::vector<Pizza>& pizzas = o.getPizzas();
+	size_t size = orderWireSize(o);
+	if (size > capacity or size > UINT32_MAX or pizzas.size() > UINT16_MAX) return 0;
+	size_t strings = sizeof(OrderWireHeader) + pizzas.size() * sizeof(OrderWirePizza);
+	auto putString = [dst, &strings](const std::string& s, uint32_t& offset, uint32_t& len) {
+		offset = (uint32_t)strings;
+		len = (uint32_t)s.size();
+		std::memcpy(dst + strings, s.data(), s.size());
+		strings += s.size();
+	};
+	OrderWireHeader h = {};
+	h.magic = OrderWireHeader::kMagic;
+	h.version = OrderWireHeader::kVersion;
+	h.pizzaCount = (uint16_t)pizzas.size();
+	h.totalSize = (uint32_t)size;
+	h.id = o.getId();
+	putString(o.getClientLogin(), h.clientLoginOffset, h.clientLoginLen);
+	putString(o.getClientName(), h.clientNameOffset, h.clientNameLen);
+	putString(o.getAddress(), h.addressOffset, h.addressLen);
+	std::memcpy(dst, &h, sizeof(h));
+	for (size_t i = 0; i < pizzas.size(); ++i) {
+		OrderWirePizza p = {};
+		p.price = pizzas[i].getPrice();
+		p.amount = pizzas[i].getAmount();
+		putString(pizzas[i].getPizzaType(), p.nameOffset, p.nameLen);
+		std::memcpy(dst + sizeof(OrderWireHeader) + i * sizeof(OrderWirePizza), &p, sizeof(p));
+	}
+	return size;
 }
 
-std::string PizzeriaDB::getClientAddress(const std::string& l) {
-	if (clientAddresses.contains(l))
-		return clientAddresses.at(l);
-	else return "Unknown";
+OrderView::OrderView(const char* data, size_t size) : data(data), size(size) {}
+
+// Fields are read with memcpy, which compiles to plain loads and stays
+// correct for buffers that are not aligned
+OrderWireHeader OrderView::header() const {
+	OrderWireHeader h;
+	std::memcpy(&h, data, sizeof(h));
+	return h;
 }
 
-std::vector<Pizza> PizzeriaDB::getPizzasAvailable() const {
-	return availablePizzas;
+OrderWirePizza OrderView::pizza(size_t i) const {
+	OrderWirePizza p;
+	std::memcpy(&p, data + sizeof(OrderWireHeader) + i * sizeof(OrderWirePizza), sizeof(p));
+	return p;
 }
 
-void PizzeriaDB::addClient(const std::string& l, const std::string& p) {
-	clientLogins[l] = p;
+bool OrderView::isValid() const {
+	if (!data or size < sizeof(OrderWireHeader)) return false;
+	OrderWireHeader h = header();
+	if (h.magic != OrderWireHeader::kMagic or h.version != OrderWireHeader::kVersion or h.totalSize > size) return false;
+	if (sizeof(OrderWireHeader) + (size_t)h.pizzaCount * sizeof(OrderWirePizza) > h.totalSize) return false;
+	auto inside = [&h](uint64_t offset, uint64_t len) { return offset + len <= h.totalSize; };
+	if (!inside(h.clientNameOffset, h.clientNameLen) or !inside(h.addressOffset, h.addressLen)
+		or !inside(h.clientLoginOffset, h.clientLoginLen)) return false;
+	for (size_t i = 0; i < h.pizzaCount; ++i) {
+		OrderWirePizza p = pizza(i);
+		if (!inside(p.nameOffset, p.nameLen)) return false;
+	}
+	return true;
 }
 
-void PizzeriaDB::saveAddress(const std::string& login, const std::string& address) {
-	clientAddresses[login] = address;
+unsigned long long OrderView::getId() const {
+	return header().id;
 }
 
-std::vector<PizzaMaker> PizzeriaDB::getPizzaMakers() {
-	return pizzaMakers;
+std::string_view OrderView::getClientLogin() const {
+	OrderWireHeader h = header();
+	return std::string_view(data + h.clientLoginOffset, h.clientLoginLen);
 }
 
-std::vector<DeliveryMan> PizzeriaDB::getCouriers() {
-	return couriers;
+std::string_view OrderView::getClientName() const {
+	OrderWireHeader h = header();
+	return std::string_view(data + h.clientNameOffset, h.clientNameLen);
 }
 
-void PizzeriaDB::addEmployee(const std::string& name) {
-	std::cout << "1 - Add pizza maker\n2 - Add deliveryman\n";
-	int n = inputInt("Choose number", 1, 2);
-	switch (n) {
-	case 1:
-		pizzaMakers.push_back(PizzaMaker(name));
-		break;
-	case 2:
-		couriers.push_back(DeliveryMan(name));
-		break;
-	}
+std::string_view OrderView::getAddress() const {
+	OrderWireHeader h = header();
+	return std::string_view(data + h.addressOffset, h.addressLen);
 }
 
-void PizzeriaDB::deleteEmployee(const std::string& s) {
-	std::cout << "1 - Delete pizza maker\n2 - Delete deliveryman\n";
-	int n = inputInt("Choose number", 1, 2);
-	int origSize;
-	switch (n) {
-	case 1:
-		origSize = pizzaMakers.size();
-		std::erase_if(pizzaMakers, [&s](PizzaMaker& e) { return e.getName() == s;  });\
-		if (origSize != pizzaMakers.size()) {
-			std::cout << "Successfully deleted employee: " << s << std::endl;
-		}
-		else std::cout << "No employee with such name was found" << std::endl;
-		break;
-	case 2:
-		origSize = couriers.size();
-		std::erase_if(couriers, [&s](DeliveryMan& e) { return e.getName() == s;  });
-		if (origSize != couriers.size()) {
-			std::cout << "Successfully deleted employee: " << s << std::endl;
-		}
-		else std::cout << "No employee with such name was found" << std::endl;
-		break;
+double OrderView::getOrderPrice() const {
+	double sum = 0;
+	for (size_t i = 0; i < getPizzaCount(); ++i) {
+		OrderWirePizza p = pizza(i);
+		sum += p.price * p.amount;
 	}
-	
+	return sum;
 }
 
-void PizzeriaDB::addPizza(const std::string& name, double price) {
-	Pizza temp(name, price);
-	availablePizzas.push_back(temp);
+size_t OrderView::getPizzaCount() const {
+	return header().pizzaCount;
 }
 
-void PizzeriaDB::deletePizza(const std::string& s) {
-	int origSize = availablePizzas.size();
-	std::erase_if(availablePizzas, [&s](Pizza& p) { return p.getPizzaType() == s; });
-	if (origSize != availablePizzas.size()) {
-		std::cout << "Successfully deleted pizza: " << s << std::endl;
-	}
-	else std::cout << "No pizza with such name was found" << std::endl;
+std::string_view OrderView::getPizzaType(size_t i) const {
+	OrderWirePizza p = pizza(i);
+	return std::string_view(data + p.nameOffset, p.nameLen);
 }
 
-void PizzeriaDB::setAdminKey(const std::string& s) {
-	AdminKey = s;
+double OrderView::getPizzaPrice(size_t i) const {
+	return pizza(i).price;
 }
 
-bool PizzeriaDB::AdminIsValid(const std::string& s) const {
-	return s == AdminKey;
+unsigned int OrderView::getPizzaAmount(size_t i) const {
+	return pizza(i).amount;
 }
 
-bool PizzeriaDB::ClientIsValid(const std::string& l, const std::string& p) const {
-	return clientLogins.contains(l) and clientLogins.at(l) == p;
+size_t OrderRing::padded(size_t n) {
+	return (n + 7) & ~size_t(7);
 }
 
-void PizzeriaDB::newOrder(const Order& o) {
-	current_orders.push(o);
+char* OrderRing::buffer() {
+	return (char*)this + sizeof(OrderRing);
 }
 
-void PizzeriaDB::complete_order() {
-	while (!current_orders.empty()) {
-		for (PizzaMaker maker : pizzaMakers) {
-			if (maker.isFree()) maker.makePizza(current_orders.front());
-			for (DeliveryMan cour : couriers) {
-				if (cour.isFree()) {
-					cour.deliver(current_orders.front());
-					break;
-				}
-			}
-			current_orders.pop();
-			break;
-		}
-	}
+size_t OrderRing::requiredBytes(size_t capacity) {
+	return sizeof(OrderRing) + padded(capacity);
 }
 
-void PizzeriaDB::saveDB() {
-	//  AdminKey
-	std::ofstream out("AdminKey.bin", std::ios::binary | std::ios::out);
-	if (!out) {
+OrderRing* OrderRing::create(void* memory, size_t capacity) {
+	OrderRing* ring = new (memory) OrderRing;
+	ring->head.store(0, std::memory_order_relaxed);
+	ring->tail.store(0, std::memory_order_relaxed);
+	ring->cachedTail = 0;
+	ring->cachedHead = 0;
+	ring->capacity = padded(capacity);
+	return ring;
+}
+
+OrderRing* OrderRing::attach(void* memory) {
+	return std::launder(reinterpret_cast<OrderRing*>(memory));
+}
+
+bool OrderRing::holds(size_t wireSize, size_t pizzaCount) const {
+	return wireSize < kWrapMarker and pizzaCount <= UINT16_MAX and padded(8 + wireSize) <= capacity;
+}
+
+// False if the order can never be pushed: it cannot be encoded or its
+// message is larger than the whole ring
+bool OrderRing::fits(const Order& o) const {
+	return holds(orderWireSize(o), o.getPizzas().size());
+}
+
+// Each message is a 4-byte length, padding up to 8 bytes and the encoded
+// order. Positions stay multiples of 8, so a message that would cross the
+// end of the buffer leaves a wrap marker there and starts over at offset 0.
+// Returns false when the ring is full and also when fits() is false, so a
+// caller that retries on false must check fits() first
+bool OrderRing::push(const Order& o) {
+	size_t wire = orderWireSize(o);
+	if (!holds(wire, o.getPizzas().size())) return false;
+	size_t need = padded(8 + wire);
+	uint64_t h = head.load(std::memory_order_relaxed);
+	size_t pos = h % capacity;
+	size_t skip = capacity - pos < need ? capacity - pos : 0;
+	if (need + skip > capacity - (h - cachedTail)) {
+		cachedTail = tail.load(std::memory_order_acquire);
+		if (need + skip > capacity - (h - cachedTail)) return false;
+	}
+	if (skip != 0) {
+		std::memcpy(buffer() + pos, &kWrapMarker, sizeof(uint32_t));
+		pos = 0;
+	}
+	uint32_t size = (uint32_t)encodeOrder(o, buffer() + pos + 8, need - 8);
+	if (size == 0) return false;
+	std::memcpy(buffer() + pos, &size, sizeof(uint32_t));
+	head.store(h + skip + need, std::memory_order_release);
+	return true;
+}
+
+// Returns an invalid view when the ring is empty. The view stays usable
+// until pop()
+OrderView OrderRing::peek() {
+	uint64_t t = tail.load(std::memory_order_relaxed);
+	if (t == cachedHead) {
+		cachedHead = head.load(std::memory_order_acquire);
+		if (t == cachedHead) return OrderView();
+	}
+	size_t pos = t % capacity;
+	uint32_t size;
+	std::memcpy(&size, buffer() + pos, sizeof(uint32_t));
+	if (size == kWrapMarker) {
+		pos = 0;
+		std::memcpy(&size, buffer(), sizeof(uint32_t));
+	}
+	return OrderView(buffer() + pos + 8, size);
+}
+
+void OrderRing::pop() {
+	uint64_t t = tail.load(std::memory_order_relaxed);
+	size_t pos = t % capacity;
+	uint32_t size;
+	std::memcpy(&size, buffer() + pos, sizeof(uint32_t));
+	if (size == kWrapMarker) {
+		t += capacity - pos;
+		std::memcpy(&size, buffer(), sizeof(uint32_t));
+	}
+	tail.store(t + padded(8 + size), std::memory_order_release);
+}
+
+#ifdef _WIN32
+SharedRegion::SharedRegion(const std::string& name, size_t size, bool create) : size(size) {
+	if (create) {
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			(DWORD)((unsigned long long)size >> 32), (DWORD)size, name.c_str());
+	}
+	else mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+	if (mapping) memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+}
+
+SharedRegion::~SharedRegion() {
+	if (memory) UnmapViewOfFile(memory);
+	if (mapping) CloseHandle(mapping);
+}
+#else
+SharedRegion::SharedRegion(const std::string& name, size_t size, bool create) : size(size), name("/" + name), owner(create) {
+	int fd = shm_open(this->name.c_str(), create ? O_CREAT | O_RDWR : O_RDWR, 0600);
+	if (fd < 0) return;
+	if (!create or ftruncate(fd, size) == 0) {
+		void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED) memory = p;
+	}
+	close(fd);
+}
+
+SharedRegion::~SharedRegion() {
+	if (memory) munmap(memory, size);
+	if (owner) shm_unlink(name.c_str());
+}
+#endif
+
+// Null if the region could not be created or opened
+void* SharedRegion::get() const {
+	return memory;
+}
+
+// Compares handing an Order over by copy with encoding it into a shared
+// memory ring that another thread reads in place
+void benchmarkOrderWire(int iterations) {
+	using clock = std::chrono::steady_clock;
+	auto nsPerOrder = [iterations](clock::duration d) {
+		return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / iterations;
+	};
+	Order o;
+	o.setId(1);
+	o.setClientLogin("benchmark");
+	o.setClientName("Benchmark client");
+	o.setAddress("Lenina street 10, flat 42");
+	o.addPizza("Margherita", 9.5, 2);
+	o.addPizza("Pepperoni", 11, 1);
+	o.addPizza("Four cheese", 12.5, 1);
+
+	std::vector<char> buf(orderWireSize(o));
+	double sink = 0;
+	auto start = clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		encodeOrder(o, buf.data(), buf.size());
+	}
+	double encodeNs = nsPerOrder(clock::now() - start);
+
+	OrderView view(buf.data(), buf.size());
+	start = clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		sink += view.getOrderPrice() + view.getClientName().size() + view.getAddress().size();
+	}
+	double decodeNs = nsPerOrder(clock::now() - start);
+
+	std::queue<Order> copies;
+	start = clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		copies.push(o);
+		sink += copies.front().getOrderPrice() + copies.front().getClientName().size();
+		copies.pop();
+	}
+	double copyNs = nsPerOrder(clock::now() - start);
+
+	const size_t ringBytes = 1 << 20;
+	SharedRegion region("pizzeria_bench_ring", OrderRing::requiredBytes(ringBytes), true);
+	if (!region.get()) {
+		std::cout << "Failed to create shared memory for the benchmark" << std::endl;
+		return;
+	}
+	OrderRing* producer = OrderRing::create(region.get(), ringBytes);
+	if (!producer->fits(o)) {
+		std::cout << "The benchmark order does not fit the ring" << std::endl;
+		return;
+	}
+	start = clock::now();
+	std::thread consumer([&region, iterations, &sink] {
+		OrderRing* ring = OrderRing::attach(region.get());
+		double local = 0;
+		for (int received = 0; received < iterations;) {
+			OrderView v = ring->peek();
+			if (!v.isValid()) {
+				std::this_thread::yield();
+				continue;
+			}
+			local += v.getOrderPrice() + v.getClientName().size();
+			ring->pop();
+			++received;
+		}
+		sink += local;
+	});
+	for (int i = 0; i < iterations;) {
+		if (producer->push(o)) ++i;
+		else std::this_thread::yield();
+	}
+	consumer.join();
+	double transferNs = nsPerOrder(clock::now() - start);
+
+	std::cout << "Orders: " << iterations << ", encoded size: " << buf.size() << " bytes" << std::endl;
+	std::cout << "Encode:                 " << encodeNs << " ns/order" << std::endl;
+	std::cout << "Decode in place:        " << decodeNs << " ns/order" << std::endl;
+	std::cout << "Copy through queue:     " << copyNs << " ns/order" << std::endl;
+	std::cout << "Shared ring round trip: " << transferNs << " ns/order" << std::endl;
+	if (sink < 0) std::cout << sink << std::endl;
+}
+
+void PizzeriaDB::readFeedbacks() {
+	for (auto now : feedbackReceiver.getReviews()) {
+		std::cout << now << std::endl;
+	}
+}
+
+std::vector<std::string>& FeedbackSystem::getReviews() {
+	return feedbacks;
+}
+
+const std::vector<std::string>& FeedbackSystem::getReviews() const {
+	return feedbacks;
+}
+
+std::string PizzeriaDB::getClientAddress(const std::string& l) {
+	ClientRecord rec;
+	if (clients.find(l, rec) and !rec.address.empty())
+		return rec.address;
+	else return "Unknown";
+}
+
+SnapshotReader<std::vector<Pizza>> PizzeriaDB::getPizzasAvailable() const {
+	return availablePizzas.load();
+}
+
+void PizzeriaDB::addClient(const std::string& l, const std::string& p) {
+	clients.setPassword(l, p);
+	journal.append({ 0, MutationType::AddClient, l, p });
+}
+
+void PizzeriaDB::saveAddress(const std::string& login, const std::string& address) {
+	clients.setAddress(login, address);
+	journal.append({ 0, MutationType::SaveAddress, login, address });
+}
+
+SnapshotReader<std::vector<PizzaMaker>> PizzeriaDB::getPizzaMakers() const {
+	return pizzaMakers.list();
+}
+
+SnapshotReader<std::vector<DeliveryMan>> PizzeriaDB::getCouriers() const {
+	return couriers.list();
+}
+
+void PizzeriaDB::addEmployee(const std::string& name) {
+	std::cout << "1 - Add pizza maker\n2 - Add deliveryman\n";
+	int n = inputInt("Choose number", 1, 2);
+	switch (n) {
+	case 1:
+		if (pizzaMakers.add(name) == pizzaMakers.npos) {
+			std::cout << "Pizza maker roster is full" << std::endl;
+			break;
+		}
+		journal.append({ 0, MutationType::AddPizzaMaker, name, "" });
+		updateKitchenRate();
+		break;
+	case 2:
+		if (couriers.add(name) == couriers.npos) {
+			std::cout << "Courier roster is full" << std::endl;
+			break;
+		}
+		journal.append({ 0, MutationType::AddCourier, name, "" });
+		break;
+	}
+}
+
+void PizzeriaDB::deleteEmployee(const std::string& s) {
+	std::cout << "1 - Delete pizza maker\n2 - Delete deliveryman\n";
+	int n = inputInt("Choose number", 1, 2);
+	size_t erased;
+	switch (n) {
+	case 1:
+		erased = pizzaMakers.remove(s);
+		if (erased != 0) {
+			journal.append({ 0, MutationType::DeletePizzaMaker, s, "" });
+			updateKitchenRate();
+			std::cout << "Successfully deleted employee: " << s << std::endl;
+		}
+		else std::cout << "No employee with such name was found" << std::endl;
+		break;
+	case 2:
+		erased = couriers.remove(s);
+		if (erased != 0) {
+			journal.append({ 0, MutationType::DeleteCourier, s, "" });
+			std::cout << "Successfully deleted employee: " << s << std::endl;
+		}
+		else std::cout << "No employee with such name was found" << std::endl;
+		break;
+	}
+	
+}
+
+void PizzeriaDB::addPizza(const std::string& name, double price) {
+	Pizza temp(name, price);
+	availablePizzas.update([&temp](std::vector<Pizza>& v) { v.push_back(temp); return true; });
+	journal.append({ 0, MutationType::AddPizza, name, "", price });
+}
+
+void PizzeriaDB::deletePizza(const std::string& s) {
+	size_t erased = availablePizzas.update([&s](std::vector<Pizza>& v) {
+		return std::erase_if(v, [&s](Pizza& p) { return p.getPizzaType() == s; });
+	});
+	if (erased != 0) {
+		journal.append({ 0, MutationType::DeletePizza, s, "" });
+		std::cout << "Successfully deleted pizza: " << s << std::endl;
+	}
+	else std::cout << "No pizza with such name was found" << std::endl;
+}
+
+void PizzeriaDB::setAdminKey(const std::string& s) {
+	AdminKey = s;
+	journal.append({ 0, MutationType::SetAdminKey, s, "" });
+}
+
+bool PizzeriaDB::AdminIsValid(const std::string& s) const {
+	return s == AdminKey;
+}
+
+bool PizzeriaDB::ClientIsValid(const std::string& l, const std::string& p) const {
+	ClientRecord rec;
+	return clients.find(l, rec) and rec.password == p;
+}
+
+static size_t orderPizzaCount(const Order& o) {
+	size_t n = 0;
+	for (const Pizza& p : o.getPizzas()) {
+		n += p.getAmount();
+	}
+	return n;
+}
+
+AdmissionQuote PizzeriaDB::quoteOrder(const Order& o) const {
+	size_t queued;
+	{
+		std::lock_guard<std::mutex> guard(ordersLock);
+		queued = current_orders.size() + deferred_orders.size();
+	}
+	size_t makers = pizzaMakers.list()->size();
+	size_t riders = couriers.list()->size();
+	return admission.quote(queued, acceptedPizzas, deferredPizzas, orderPizzaCount(o), makers, riders, planner.getTripCapacity());
+}
+
+// The customer saw the quote and walked away
+void PizzeriaDB::declineOrder(const Order& o, AdmissionQuote q) {
+	q.decision = AdmissionDecision::Declined;
+	admission.record(o, q);
+}
+
+// Places the order on the terms of the quote the customer confirmed, so it
+// is not deferred behind their back. Returns the order ID, or 0 if that
+// quote was a rejection
+unsigned long long PizzeriaDB::newOrder(Order o, const AdmissionQuote& confirmed) {
+	if (confirmed.decision == AdmissionDecision::Reject) {
+		admission.record(o, confirmed);
+		return 0;
+	}
+	o.setId(++lastOrderId);
+	admission.record(o, confirmed);
+	popularity.recordOrder(o);
+	std::lock_guard<std::mutex> guard(ordersLock);
+	if (confirmed.decision == AdmissionDecision::Defer) {
+		deferredPizzas += orderPizzaCount(o);
+		deferred_orders.push(o);
+		statusBus.publish(o, OrderStage::Deferred);
+	}
+	else admit(o);
+	return o.getId();
+}
+
+// Puts an order in the kitchen queue. Called with ordersLock held
+void PizzeriaDB::admit(const Order& o) {
+	admitted[o.getId()] = { std::chrono::steady_clock::now(), acceptedPizzas + orderPizzaCount(o) };
+	acceptedPizzas += orderPizzaCount(o);
+	current_orders.push(o);
+	statusBus.publish(o, OrderStage::Accepted);
+}
+
+// A deferred order is let into the kitchen once the accepted work, including
+// what is already on the stations, fits the latency budget with it, or when
+// the kitchen has no accepted work at all. Called with ordersLock held
+void PizzeriaDB::promoteDeferred() {
+	while (!deferred_orders.empty()) {
+		const Order& o = deferred_orders.front();
+		size_t makers = pizzaMakers.list()->size();
+		size_t riders = couriers.list()->size();
+		AdmissionQuote q = admission.quote(current_orders.size(), acceptedPizzas, 0, orderPizzaCount(o), makers, riders, planner.getTripCapacity());
+		if (acceptedPizzas != 0 and q.decision != AdmissionDecision::Accept) break;
+		deferredPizzas -= orderPizzaCount(o);
+		admit(o);
+		deferred_orders.pop();
+	}
+}
+
+// Pipeline intake; returns false once nothing is accepted, which lets the
+// stations drain and ends the run
+bool PizzeriaDB::nextOrder(Order& o) {
+	std::lock_guard<std::mutex> guard(ordersLock);
+	promoteDeferred();
+	if (current_orders.empty()) return false;
+	o = current_orders.front();
+	current_orders.pop();
+	return true;
+}
+
+// Background kitchen, so cooking never holds up a customer's console.
+// Whenever accepted orders wait it takes as many idle makers off the roster
+// as the stations have slots for and
+// runs the pipeline until the queue is empty; in between it wakes up when
+// the planner says the held deliveries are due
+void PizzeriaDB::kitchenLoop() {
+	auto onStart = [this](const Order& o) {
+		statusBus.publish(o, OrderStage::Preparing);
+	};
+	auto onDone = [this](const Order& o) {
+		statusBus.publish(o, OrderStage::Ready);
+		planner.addReady(o);
+		{
+			std::lock_guard<std::mutex> guard(ordersLock);
+			auto it = admitted.find(o.getId());
+			if (it != admitted.end()) {
+				std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - it->second.first;
+				admission.observeKitchen(took.count() / KitchenPipeline::kMillisPerMinute, it->second.second);
+				admitted.erase(it);
+			}
+		}
+		acceptedPizzas -= orderPizzaCount(o);
+		dispatchDeliveries(false);
+	};
+	std::unique_lock<std::mutex> guard(ordersLock);
+	while (true) {
+		promoteDeferred();
+		if (current_orders.empty()) {
+			if (stopping) return;
+			guard.unlock();
+			dispatchDeliveries(false);
+			guard.lock();
+			ordersChanged.wait_for(guard, planner.untilDue(), [this] {
+				return stopping or !current_orders.empty() or !deferred_orders.empty();
+			});
+			continue;
+		}
+		std::vector<size_t> crewIds;
+		while (crewIds.size() < kitchen.maxCrew()) {
+			size_t id = pizzaMakers.acquire();
+			if (id == pizzaMakers.npos) break;
+			crewIds.push_back(id);
+		}
+		if (crewIds.empty()) {
+			// finishOrders stops waiting once it sees the roster is empty
+			ordersChanged.notify_all();
+			if (stopping and pizzaMakers.list()->empty()) return;
+			ordersChanged.wait_for(guard, std::chrono::seconds(1));
+			continue;
+		}
+		kitchenBusy = true;
+		guard.unlock();
+		std::vector<PizzaMaker> crew;
+		for (size_t id : crewIds) {
+			crew.push_back(pizzaMakers.get(id));
+		}
+		kitchen.run([this](Order& o) { return nextOrder(o); }, crew, onStart, onDone);
+		for (size_t id : crewIds) {
+			pizzaMakers.release(id);
+		}
+		guard.lock();
+		kitchenBusy = false;
+		ordersChanged.notify_all();
+	}
+}
+
+// Waits until everything queued, deferred orders included, is cooked and
+// sends out what is still held for batching
+void PizzeriaDB::finishOrders() {
+	complete_order();
+	{
+		std::unique_lock<std::mutex> guard(ordersLock);
+		ordersChanged.wait(guard, [this] {
+			return (current_orders.empty() and deferred_orders.empty() and !kitchenBusy) or pizzaMakers.list()->empty();
+		});
+		size_t left = current_orders.size() + deferred_orders.size();
+		if (left != 0) std::cout << "No pizza makers, " << left << " orders were not cooked" << std::endl;
+	}
+	dispatchDeliveries(true);
+}
+
+PizzeriaDB::~PizzeriaDB() {
+	{
+		std::lock_guard<std::mutex> guard(ordersLock);
+		stopping = true;
+	}
+	ordersChanged.notify_all();
+	if (kitchenThread.joinable()) kitchenThread.join();
+}
+
+// The admission quote uses the pipeline model's rate for the current crew
+void PizzeriaDB::updateKitchenRate() {
+	admission.setKitchenRate(kitchen.minutesPerPizza(pizzaMakers.list()->size()));
+}
+
+void PizzeriaDB::printAdmissionSettings() const {
+	admission.printSettings();
+}
+
+void PizzeriaDB::setAdmissionBudgets(double budgetMinutes, double deferBudgetMinutes) {
+	admission.setBudgets(budgetMinutes, deferBudgetMinutes);
+}
+
+const OrderStatusBus& PizzeriaDB::getStatusBus() const {
+	return statusBus;
+}
+
+std::vector<std::string> PizzeriaDB::getPopularPizzas(size_t k) const {
+	return popularity.mostPopular(k);
+}
+
+std::vector<std::string> PizzeriaDB::getOrderedWith(const std::string& pizza, size_t k) const {
+	return popularity.orderedWith(pizza, k);
+}
+
+// Hands the queued orders to the background kitchen, starting it with the
+// first order
+void PizzeriaDB::complete_order() {
+	std::lock_guard<std::mutex> guard(ordersLock);
+	if (!kitchenThread.joinable()) kitchenThread = std::thread(&PizzeriaDB::kitchenLoop, this);
+	ordersChanged.notify_all();
+}
+
+// Runs on the kitchen thread, so nothing here writes to the console; trips
+// and couriers show up in the delivery report. Trips without a free courier
+// go back to the planner for the next round
+void PizzeriaDB::dispatchDeliveries(bool flush) {
+	for (const DeliveryTrip& trip : planner.plan(flush)) {
+		size_t courierId = couriers.acquire();
+		if (courierId == couriers.npos) {
+			planner.putBack(trip);
+			continue;
+		}
+		admission.notePlannedTrip(trip.minutes);
+		for (const Order& o : trip.stops) {
+			statusBus.publish(o, OrderStage::OutForDelivery);
+		}
+		std::string courier = couriers.get(courierId).getName();
+		couriers.release(courierId);
+		planner.dispatched(trip, courier);
+		for (const Order& o : trip.stops) {
+			statusBus.publish(o, OrderStage::Delivered);
+		}
+	}
+}
+
+void PizzeriaDB::printDeliveryReport() const {
+	planner.printReport();
+}
+
+void PizzeriaDB::printKitchenReport() const {
+	kitchen.printReport();
+}
+
+void PizzeriaDB::saveDB() {
+	// Orders still waiting, deferred or held for batching, leave before the program stops
+	finishOrders();
+	//  AdminKey
+	std::ofstream out("AdminKey.bin", std::ios::binary | std::ios::out);
+	if (!out) {
 		std::cout << "Failed to open AdminKey.bin for writing." << std::endl;
 		return;
 	}
@@ -322,9 +1871,10 @@ void PizzeriaDB::saveDB() {
 		std::cout << "Failed to open PizzaCatalogue.bin for writing." << std::endl;
 		return;
 	}
-	size_t pizzaCount = availablePizzas.size();
+	SnapshotReader<std::vector<Pizza>> catalogue = availablePizzas.load();
+	size_t pizzaCount = catalogue->size();
 	out.write((char*)&pizzaCount, sizeof(size_t));
-	for (const auto& pizza : availablePizzas) {
+	for (const auto& pizza : *catalogue) {
 		size_t typeLen = pizza.getPizzaType().size();
 		out.write((char*)&typeLen, sizeof(size_t));
 		const std::string& pizzaType = pizza.getPizzaType();
@@ -340,9 +1890,10 @@ void PizzeriaDB::saveDB() {
 		std::cout << "Failed to open WorkersDB.bin for writing." << std::endl;
 		return;
 	}
-	size_t PizzaMakerCount = pizzaMakers.size();
+	SnapshotReader<std::vector<PizzaMaker>> makers = pizzaMakers.list();
+	size_t PizzaMakerCount = makers->size();
 	out.write((char*)&PizzaMakerCount, sizeof(size_t));
-	for (const auto& worker : pizzaMakers) {
+	for (const auto& worker : *makers) {
 		size_t nameLen = worker.getName().size();
 		out.write((char*)&nameLen, sizeof(size_t));
 		out.write(worker.getName().c_str(), nameLen);
@@ -355,66 +1906,63 @@ void PizzeriaDB::saveDB() {
 		std::cout << "Failed to open DeliveryManDB.bin for writing." << std::endl;
 		return;
 	}
-	size_t workerCount = couriers.size();
+	SnapshotReader<std::vector<DeliveryMan>> roster = couriers.list();
+	size_t workerCount = roster->size();
 	out.write((char*)&workerCount, sizeof(size_t));
-	for (const auto& worker : couriers) {
+	for (const auto& worker : *roster) {
 		size_t nameLen = worker.getName().size();
 		out.write((char*)&nameLen, sizeof(size_t));
 		out.write(worker.getName().c_str(), nameLen);
 	}
 	out.close();
 
-	//  ClientData
-	out.open("ClientData.bin", std::ios::binary | std::ios::out);
+	clients.merge();
+
+	//  Reviews
+	out.open("Reviews.bin", std::ios::binary | std::ios::out);
 	if (!out) {
-		std::cout << "Failed to open ClientData.bin for writing." << std::endl;
+		std::cout << "Failed to open DeliveryManDB.bin for writing." << std::endl;
 		return;
 	}
-	size_t clientDataSize = clientLogins.size();
-	out.write((char*)&clientDataSize, sizeof(size_t));
-	for (const auto& entry : clientLogins) {
-		size_t keyLen = entry.first.size();
-		out.write((char*)&keyLen, sizeof(size_t));
-		out.write(entry.first.c_str(), keyLen);
-
-		size_t valueLen = entry.second.size();
-		out.write((char*)&valueLen, sizeof(size_t));
-		out.write(entry.second.c_str(), valueLen);
+	size_t reviewsSize = feedbackReceiver.getReviews().size();
+	out.write((char*)&reviewsSize, sizeof(size_t));
+	for (const auto& review : feedbackReceiver.getReviews()) {
+		size_t nameLen = review.size();
+		out.write((char*)&nameLen, sizeof(size_t));
+		out.write(review.c_str(), nameLen);
 	}
 	out.close();
 
-	//  ClientAddresses
-	out.open("ClientAddresses.bin", std::ios::binary | std::ios::out);
+	out.open("Popularity.bin", std::ios::binary | std::ios::out);
 	if (!out) {
-		std::cout << "Failed to open ClientAddresses.bin for writing." << std::endl;
+		std::cout << "Failed to open Popularity.bin for writing." << std::endl;
 		return;
 	}
-	size_t clientAdrSize = clientAddresses.size();
-	out.write((char*)&clientAdrSize, sizeof(size_t));
-	for (const auto& entry : clientAddresses) {
-		size_t keyLen = entry.first.size();
-		out.write((char*)&keyLen, sizeof(size_t));
-		out.write(entry.first.c_str(), keyLen);
+	popularity.save(out);
+	out.close();
 
-		size_t valueLen = entry.second.size();
-		out.write((char*)&valueLen, sizeof(size_t));
-		out.write(entry.second.c_str(), valueLen);
+	out.open("DeliveryStats.bin", std::ios::binary | std::ios::out);
+	if (!out) {
+		std::cout << "Failed to open DeliveryStats.bin for writing." << std::endl;
+		return;
 	}
+	planner.save(out);
 	out.close();
 
-	//  Reviews
-	out.open("Reviews.bin", std::ios::binary | std::ios::out);
+	out.open("Admission.bin", std::ios::binary | std::ios::out);
 	if (!out) {
-		std::cout << "Failed to open DeliveryManDB.bin for writing." << std::endl;
+		std::cout << "Failed to open Admission.bin for writing." << std::endl;
 		return;
 	}
-	size_t reviewsSize = feedbackReceiver.getReviews().size();
-	out.write((char*)&reviewsSize, sizeof(size_t));
-	for (const auto& review : feedbackReceiver.getReviews()) {
-		size_t nameLen = review.size();
-		out.write((char*)&nameLen, sizeof(size_t));
-		out.write(review.c_str(), nameLen);
+	admission.save(out);
+	out.close();
+
+	out.open("KitchenStats.bin", std::ios::binary | std::ios::out);
+	if (!out) {
+		std::cout << "Failed to open KitchenStats.bin for writing." << std::endl;
+		return;
 	}
+	kitchen.save(out);
 	out.close();
 }
 
@@ -445,7 +1993,7 @@ void PizzeriaDB::getDB() {
 	}
 	size_t pizzaCount;
 	in.read((char*)&pizzaCount, sizeof(size_t));
-	availablePizzas.resize(pizzaCount);
+	std::vector<Pizza> catalogue(pizzaCount);
 	for (size_t i = 0; i < pizzaCount; ++i) {
 		Pizza pizza;
 		size_t typeLen;
@@ -456,8 +2004,9 @@ void PizzeriaDB::getDB() {
 		double price;
 		in.read((char*)&price, sizeof(double));
 		pizza.setPrice(price);
-		availablePizzas[i] = pizza;
+		catalogue[i] = pizza;
 	}
+	availablePizzas.publish(std::move(catalogue));
 	in.close();
 
 	//  PizzaMakerDB
@@ -471,7 +2020,7 @@ void PizzeriaDB::getDB() {
 	}
 	size_t PizzaMakerCount;
 	in.read((char*)&PizzaMakerCount, sizeof(size_t));
-	pizzaMakers.resize(PizzaMakerCount);
+	std::vector<PizzaMaker> makers(PizzaMakerCount);
 	for (size_t i = 0; i < PizzaMakerCount; ++i) {
 		PizzaMaker employee;
 		size_t nameLen = 20;
@@ -479,8 +2028,9 @@ void PizzeriaDB::getDB() {
 		std::string name(nameLen, '\0');
 		in.read(&name[0], nameLen);
 		employee.setName(name);
-		pizzaMakers[i] = employee;
+		makers[i] = employee;
 	}
+	pizzaMakers.load(makers);
 	in.close();
 
 	//  DeliveryManDB
@@ -489,95 +2039,1013 @@ void PizzeriaDB::getDB() {
 		std::cout << "Failed to open WorkersDB.bin for reading." << std::endl;
 		return;
 	}
-	if (in.peek() == std::ifstream::traits_type::eof()) {
-		return;
+	if (in.peek() == std::ifstream::traits_type::eof()) {
+		return;
+	}
+	size_t workerCount;
+	in.read((char*)&workerCount, sizeof(size_t));
+	std::vector<DeliveryMan> roster(workerCount);
+	for (size_t i = 0; i < workerCount; ++i) {
+		DeliveryMan employee;
+		size_t nameLen = 20;
+		in.read((char*)&nameLen, sizeof(size_t));
+		std::string name(nameLen, '\0');
+		in.read(&name[0], nameLen);
+		employee.setName(name);
+		roster[i] = employee;
+	}
+	couriers.load(roster);
+	in.close();
+
+	if (!clients.open()) {
+		migrateLegacyClients();
+	}
+
+	//  Reviews
+	in.open("Reviews.bin", std::ios::binary);
+	if (!in) {
+		std::cout << "Failed to open Reviews.bin for reading." << std::endl;
+		return;
+	}
+	if (in.peek() == std::ifstream::traits_type::eof()) {
+		return;
+	}
+	size_t reviewCount;
+	in.read((char*)&reviewCount, sizeof(size_t));
+	feedbackReceiver.getReviews().resize(reviewCount);
+	for (size_t i = 0; i < reviewCount; ++i) {
+		std::string temp;
+		size_t nameLen;
+		in.read((char*)&nameLen, sizeof(size_t));
+		std::string review(nameLen, '\0');
+		in.read(&review[0], nameLen);
+		feedbackReceiver.getReviews()[i] = review;	
+	}
+	in.close();
+
+	// Statistics are optional, a missing file just means nothing was counted yet
+	in.open("Popularity.bin", std::ios::binary);
+	if (in and in.peek() != std::ifstream::traits_type::eof()) {
+		popularity.load(in);
+	}
+	in.close();
+	in.clear();
+
+	in.open("DeliveryStats.bin", std::ios::binary);
+	if (in and in.peek() != std::ifstream::traits_type::eof()) {
+		planner.load(in);
+	}
+	in.close();
+	in.clear();
+
+	in.open("Admission.bin", std::ios::binary);
+	if (in and in.peek() != std::ifstream::traits_type::eof()) {
+		admission.load(in);
+	}
+	in.close();
+	in.clear();
+
+	in.open("KitchenStats.bin", std::ios::binary);
+	if (in and in.peek() != std::ifstream::traits_type::eof()) {
+		kitchen.load(in);
+	}
+	in.close();
+	updateKitchenRate();
+}
+
+SpaceSaving::SpaceSaving(size_t capacity) : capacity(capacity) {}
+
+void SpaceSaving::add(const std::string& key, unsigned long long weight) {
+	Counter* smallest = nullptr;
+	for (Counter& c : counters) {
+		if (c.key == key) {
+			c.count += weight;
+			return;
+		}
+		if (!smallest or c.count < smallest->count) smallest = &c;
+	}
+	if (counters.size() < capacity) {
+		counters.push_back({ key, weight, 0 });
+		return;
+	}
+	// The new key takes over the smallest counter and inherits its count as error
+	smallest->key = key;
+	smallest->error = smallest->count;
+	smallest->count += weight;
+}
+
+void SpaceSaving::clear() {
+	counters.clear();
+}
+
+std::vector<std::pair<std::string, unsigned long long>> SpaceSaving::top(size_t k) const {
+	std::vector<std::pair<std::string, unsigned long long>> result;
+	for (const Counter& c : counters) {
+		result.emplace_back(c.key, c.count);
+	}
+	std::sort(result.begin(), result.end(), [](auto& a, auto& b) { return a.second > b.second; });
+	if (result.size() > k) result.resize(k);
+	return result;
+}
+
+void SpaceSaving::save(std::ofstream& out) const {
+	size_t count = counters.size();
+	out.write((char*)&count, sizeof(size_t));
+	for (const Counter& c : counters) {
+		size_t keyLen = c.key.size();
+		out.write((char*)&keyLen, sizeof(size_t));
+		out.write(c.key.c_str(), keyLen);
+		out.write((char*)&c.count, sizeof(c.count));
+		out.write((char*)&c.error, sizeof(c.error));
+	}
+}
+
+void SpaceSaving::load(std::ifstream& in) {
+	size_t count = 0;
+	in.read((char*)&count, sizeof(size_t));
+	counters.clear();
+	for (size_t i = 0; i < count and in; ++i) {
+		Counter c;
+		size_t keyLen;
+		in.read((char*)&keyLen, sizeof(size_t));
+		c.key.resize(keyLen);
+		in.read(&c.key[0], keyLen);
+		in.read((char*)&c.count, sizeof(c.count));
+		in.read((char*)&c.error, sizeof(c.error));
+		if (counters.size() < capacity) counters.push_back(c);
+	}
+}
+
+PopularityStats::PopularityStats() : pizzas{ SpaceSaving(32), SpaceSaving(32) }, pairs{ SpaceSaving(64), SpaceSaving(64) } {
+	windowStart = nowMinutes() / kWindowMinutes * kWindowMinutes;
+}
+
+long long PopularityStats::nowMinutes() {
+	using namespace std::chrono;
+	return duration_cast<minutes>(system_clock::now().time_since_epoch()).count();
+}
+
+// Index 0 is the current window, index 1 the previous one
+void PopularityStats::rotate(long long now) {
+	long long passed = (now - windowStart) / kWindowMinutes;
+	if (passed <= 0) return;
+	if (passed == 1) {
+		std::swap(pizzas[0], pizzas[1]);
+		std::swap(pairs[0], pairs[1]);
+	}
+	else {
+		pizzas[1].clear();
+		pairs[1].clear();
+	}
+	pizzas[0].clear();
+	pairs[0].clear();
+	windowStart += passed * kWindowMinutes;
+}
+
+void PopularityStats::recordOrder(const Order& o) {
+	std::vector<std::string> names;
+	for (const Pizza& p : o.getPizzas()) {
+		if (names.size() == kMaxPizzasPerOrder) break;
+		if (std::find(names.begin(), names.end(), p.getPizzaType()) == names.end())
+			names.push_back(p.getPizzaType());
+	}
+	std::sort(names.begin(), names.end());
+	std::lock_guard<std::mutex> guard(lock);
+	rotate(nowMinutes());
+	for (const Pizza& p : o.getPizzas()) {
+		pizzas[0].add(p.getPizzaType(), p.getAmount());
+	}
+	for (size_t i = 0; i < names.size(); ++i) {
+		for (size_t j = i + 1; j < names.size(); ++j) {
+			pairs[0].add(names[i] + '\n' + names[j]);
+		}
+	}
+}
+
+std::vector<std::string> PopularityStats::mostPopular(size_t k) const {
+	std::unordered_map<std::string, unsigned long long> merged;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (const SpaceSaving& window : pizzas) {
+			for (auto& [name, count] : window.top(k * 2)) merged[name] += count;
+		}
+	}
+	std::vector<std::pair<std::string, unsigned long long>> sorted(merged.begin(), merged.end());
+	std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) { return a.second > b.second; });
+	std::vector<std::string> result;
+	for (size_t i = 0; i < sorted.size() and i < k; ++i) {
+		result.push_back(sorted[i].first);
+	}
+	return result;
+}
+
+std::vector<std::string> PopularityStats::orderedWith(const std::string& pizza, size_t k) const {
+	std::unordered_map<std::string, unsigned long long> merged;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (const SpaceSaving& window : pairs) {
+			for (auto& [pair, count] : window.top((size_t)-1)) {
+				size_t sep = pair.find('\n');
+				std::string first = pair.substr(0, sep), second = pair.substr(sep + 1);
+				if (first == pizza) merged[second] += count;
+				else if (second == pizza) merged[first] += count;
+			}
+		}
+	}
+	std::vector<std::pair<std::string, unsigned long long>> sorted(merged.begin(), merged.end());
+	std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) { return a.second > b.second; });
+	std::vector<std::string> result;
+	for (size_t i = 0; i < sorted.size() and i < k; ++i) {
+		result.push_back(sorted[i].first);
+	}
+	return result;
+}
+
+void PopularityStats::save(std::ofstream& out) const {
+	std::lock_guard<std::mutex> guard(lock);
+	out.write((char*)&windowStart, sizeof(windowStart));
+	for (int i = 0; i < 2; ++i) {
+		pizzas[i].save(out);
+		pairs[i].save(out);
+	}
+}
+
+void PopularityStats::load(std::ifstream& in) {
+	std::lock_guard<std::mutex> guard(lock);
+	in.read((char*)&windowStart, sizeof(windowStart));
+	for (int i = 0; i < 2; ++i) {
+		pizzas[i].load(in);
+		pairs[i].load(in);
+	}
+	rotate(nowMinutes());
+}
+
+// Builds ClientIndex.bin once from the old ClientData.bin and ClientAddresses.bin
+void PizzeriaDB::migrateLegacyClients() {
+	std::ifstream in;
+	//  ClientAdresses
+	in.open("ClientAddresses.bin", std::ios::binary);
+	if (!in) {
+		std::cout << "Failed to open ClientAddresses.bin for reading." << std::endl;
+		return;
+	}
+	if (in.peek() == std::ifstream::traits_type::eof()) {
+		return;
+	}
+	size_t clientAdrSize;
+	in.read((char*)&clientAdrSize, sizeof(size_t));
+	std::unordered_map<std::string, std::string> clientAddresses;
+	for (size_t i = 0; i < clientAdrSize; ++i) {
+		size_t keyLen, valueLen;
+		in.read((char*)&keyLen, sizeof(size_t));
+		std::string key(keyLen, '\0');
+		in.read(&key[0], keyLen);
+
+		in.read((char*)&valueLen, sizeof(size_t));
+		std::string value(valueLen, '\0');
+		in.read(&value[0], valueLen);
+
+		clientAddresses[key] = value;
+	}
+	in.close();
+
+	in.open("ClientData.bin", std::ios::binary);
+	if (!in) {
+		std::cout << "Failed to open ClientData.bin for reading." << std::endl;
+		return;
+	}
+	if (in.peek() == std::ifstream::traits_type::eof()) {
+		return;
+	}
+	size_t clientDataSize;
+	in.read((char*)&clientDataSize, sizeof(size_t));
+	std::unordered_map<std::string, std::string> clientLogins;
+	for (size_t i = 0; i < clientDataSize; ++i) {
+		size_t keyLen, valueLen;
+		in.read((char*)&keyLen, sizeof(size_t));
+		std::string key(keyLen, '\0');
+		in.read(&key[0], keyLen);
+
+		in.read((char*)&valueLen, sizeof(size_t));
+		std::string value(valueLen, '\0');
+		in.read(&value[0], valueLen);
+
+		clientLogins[key] = value;
+	}
+	in.close();
+
+	clients.build(clientLogins, clientAddresses);
+}
+
+uint64_t fnv1a(std::string_view s) {
+	uint64_t h = 1469598103934665603ull;
+	for (char c : s) {
+		h = (h ^ (unsigned char)c) * 1099511628211ull;
+	}
+	return h;
+}
+
+const char* stageName(OrderStage stage) {
+	switch (stage) {
+	case OrderStage::Accepted:
+		return "accepted";
+	case OrderStage::Deferred:
+		return "waiting for a free kitchen slot";
+	case OrderStage::Preparing:
+		return "being prepared";
+	case OrderStage::Ready:
+		return "ready";
+	case OrderStage::OutForDelivery:
+		return "out for delivery";
+	case OrderStage::Delivered:
+		return "delivered";
+	}
+	return "unknown";
+}
+
+OrderStatusBus::OrderStatusBus() : slots(new Slot[kSlots]) {}
+
+// Slot sequence for event n is 2n+1 while it is written and 2n+2 once done
+void OrderStatusBus::publish(const Order& o, OrderStage stage) {
+	OrderEvent e;
+	e.orderId = o.getId();
+	e.loginHash = fnv1a(o.getClientLogin());
+	e.timeMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	e.stage = stage;
+	uint64_t packed[kWords] = { e.orderId, e.loginHash, (uint64_t)e.timeMs, (uint64_t)e.stage };
+
+	uint64_t n = next.fetch_add(1, std::memory_order_relaxed);
+	Slot& slot = slots[n % kSlots];
+	slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (size_t i = 0; i < kWords; ++i) {
+		slot.words[i].store(packed[i], std::memory_order_relaxed);
+	}
+	slot.seq.store(2 * n + 2, std::memory_order_release);
+	slot.seq.notify_all();
+}
+
+OrderStatusBus::ReadResult OrderStatusBus::read(uint64_t index, OrderEvent& e) const {
+	const Slot& slot = slots[index % kSlots];
+	uint64_t before = slot.seq.load(std::memory_order_acquire);
+	if (before < 2 * index + 2) return ReadResult::Empty;
+	if (before > 2 * index + 2) return ReadResult::Overrun;
+	uint64_t packed[kWords];
+	for (size_t i = 0; i < kWords; ++i) {
+		packed[i] = slot.words[i].load(std::memory_order_relaxed);
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (slot.seq.load(std::memory_order_relaxed) != before) return ReadResult::Overrun;
+	e.orderId = packed[0];
+	e.loginHash = packed[1];
+	e.timeMs = (int64_t)packed[2];
+	e.stage = (OrderStage)packed[3];
+	return ReadResult::Ok;
+}
+
+// Number of events published so far
+uint64_t OrderStatusBus::position() const {
+	return next.load(std::memory_order_acquire);
+}
+
+// Starts at from, so a watcher that took position() before placing the
+// order sees every stage of it even though the ID was not known yet
+StatusSubscription OrderStatusBus::subscribeOrder(unsigned long long orderId, uint64_t from) const {
+	return StatusSubscription(this, from, orderId, 0);
+}
+
+StatusSubscription OrderStatusBus::subscribeClient(const std::string& login) const {
+	return StatusSubscription(this, next.load(std::memory_order_acquire), 0, fnv1a(login));
+}
+
+StatusSubscription::StatusSubscription(const OrderStatusBus* bus, uint64_t cursor, uint64_t orderId, uint64_t loginHash)
+	: bus(bus), cursor(cursor), orderId(orderId), loginHash(loginHash) {}
+
+bool StatusSubscription::matches(const OrderEvent& e) const {
+	return (orderId != 0 and e.orderId == orderId) or (loginHash != 0 and e.loginHash == loginHash);
+}
+
+// Returns false once every published event has been looked at
+bool StatusSubscription::tryNext(OrderEvent& e) {
+	while (true) {
+		switch (bus->read(cursor, e)) {
+		case OrderStatusBus::ReadResult::Empty:
+			return false;
+		case OrderStatusBus::ReadResult::Overrun: {
+			uint64_t oldest = bus->next.load(std::memory_order_acquire) - OrderStatusBus::kSlots + 1;
+			missed += oldest - cursor;
+			cursor = oldest;
+			break;
+		}
+		case OrderStatusBus::ReadResult::Ok:
+			++cursor;
+			if (matches(e)) return true;
+			break;
+		}
+	}
+}
+
+// Blocks until a matching event is published
+void StatusSubscription::next(OrderEvent& e) {
+	while (!tryNext(e)) {
+		const std::atomic<uint64_t>& seq = bus->slots[cursor % OrderStatusBus::kSlots].seq;
+		uint64_t seen = seq.load(std::memory_order_acquire);
+		if (seen < 2 * cursor + 2) seq.wait(seen, std::memory_order_acquire);
+	}
+}
+
+unsigned long long StatusSubscription::getMissed() const {
+	return missed;
+}
+
+// Addresses are free text, so they are placed on the city map
+// deterministically: every street gets a fixed spot within 6 km of the
+// pizzeria and the house number moves along it. A geocoder can replace this
+GeoPoint locateAddress(const std::string& address) {
+	std::string street;
+	int house = 0;
+	bool inNumber = false, numberDone = false;
+	for (char c : address) {
+		if (c >= '0' and c <= '9') {
+			if (!numberDone) {
+				house = house * 10 + (c - '0');
+				inNumber = true;
+			}
+		}
+		else {
+			if (inNumber) numberDone = true;
+			if (std::isalpha((unsigned char)c)) street += (char)std::tolower((unsigned char)c);
+		}
+	}
+	uint64_t h = fnv1a(street);
+	const double pi = 3.14159265358979;
+	double angle = (h % 3600) / 3600.0 * 2 * pi;
+	double radius = 0.5 + (h / 3600 % 1000) / 1000.0 * 5.5;
+	double direction = (h / 3600000 % 360) / 360.0 * 2 * pi;
+	double along = (house % 200) * 0.015;
+	return { radius * std::cos(angle) + along * std::cos(direction), radius * std::sin(angle) + along * std::sin(direction) };
+}
+
+double distanceKm(const GeoPoint& a, const GeoPoint& b) {
+	return std::hypot(a.x - b.x, a.y - b.y);
+}
+
+DeliveryPlanner::DeliveryPlanner(size_t tripCapacity, double promiseMinutes, double windowMinutes, double millisPerMinute)
+	: tripCapacity(tripCapacity), promiseMinutes(promiseMinutes), windowMinutes(windowMinutes), millisPerMinute(millisPerMinute) {}
+
+size_t DeliveryPlanner::getTripCapacity() const {
+	return tripCapacity;
+}
+
+void DeliveryPlanner::addReady(const Order& o) {
+	std::lock_guard<std::mutex> guard(lock);
+	readySince.emplace(o.getId(), std::chrono::steady_clock::now());
+	ready.push_back(o);
+}
+
+// Called with lock held
+double DeliveryPlanner::minutesWaited(const Order& o, std::chrono::steady_clock::time_point now) const {
+	auto it = readySince.find(o.getId());
+	if (it == readySince.end()) return 0;
+	return std::chrono::duration<double, std::milli>(now - it->second).count() / millisPerMinute;
+}
+
+// Minutes until the held orders have to leave. An order's slack is what is
+// left of its promise after the drive straight to it and the other stops
+// of a full trip. After a trip found no courier nothing is due before
+// heldUntil. Called with lock held
+double DeliveryPlanner::dueInMinutes(std::chrono::steady_clock::time_point now) const {
+	if (ready.empty()) return std::numeric_limits<double>::infinity();
+	double due = ready.size() >= tripCapacity ? 0 : std::numeric_limits<double>::infinity();
+	for (const Order& o : ready) {
+		double waited = minutesWaited(o, now);
+		double drive = distanceKm(GeoPoint(), locateAddress(o.getAddress())) / kSpeedKmh * 60;
+		double slack = promiseMinutes - waited - drive - (tripCapacity - 1) * kMinutesPerStop;
+		due = std::min({ due, windowMinutes - waited, slack });
+	}
+	double held = std::chrono::duration<double, std::milli>(heldUntil - now).count() / millisPerMinute;
+	return std::max(due, held);
+}
+
+// Real time until plan() has trips to send, at most a minute
+std::chrono::milliseconds DeliveryPlanner::untilDue() const {
+	std::lock_guard<std::mutex> guard(lock);
+	double ms = dueInMinutes(std::chrono::steady_clock::now()) * millisPerMinute;
+	return std::chrono::milliseconds((long long)std::ceil(std::clamp(ms, 0.0, 60000.0)));
+}
+
+// Visiting order of points (the pizzeria is implied at both ends):
+// nearest neighbour, then 2-opt until no reversal shortens the tour
+std::vector<size_t> DeliveryPlanner::route(const std::vector<GeoPoint>& points) const {
+	std::vector<GeoPoint> tour = { GeoPoint() };
+	std::vector<size_t> order;
+	std::vector<bool> used(points.size());
+	for (size_t step = 0; step < points.size(); ++step) {
+		size_t best = 0;
+		double bestDist = -1;
+		for (size_t i = 0; i < points.size(); ++i) {
+			double d = distanceKm(tour.back(), points[i]);
+			if (!used[i] and (bestDist < 0 or d < bestDist)) {
+				best = i;
+				bestDist = d;
+			}
+		}
+		used[best] = true;
+		order.push_back(best);
+		tour.push_back(points[best]);
+	}
+	tour.push_back(GeoPoint());
+	bool improved = true;
+	while (improved) {
+		improved = false;
+		for (size_t i = 1; i + 1 < tour.size(); ++i) {
+			for (size_t j = i + 1; j + 1 < tour.size(); ++j) {
+				double before = distanceKm(tour[i - 1], tour[i]) + distanceKm(tour[j], tour[j + 1]);
+				double after = distanceKm(tour[i - 1], tour[j]) + distanceKm(tour[i], tour[j + 1]);
+				if (after + 1e-9 < before) {
+					std::reverse(tour.begin() + i, tour.begin() + j + 1);
+					std::reverse(order.begin() + i - 1, order.begin() + j);
+					improved = true;
+				}
+			}
+		}
+	}
+	return order;
+}
+
+// Returns the latest arrival counted from when each order became ready, in
+// minutes, and the length of the round trip
+double DeliveryPlanner::arrivals(const std::vector<GeoPoint>& points, const std::vector<double>& waited, const std::vector<size_t>& order, double& km) const {
+	GeoPoint at;
+	km = 0;
+	double latest = 0;
+	for (size_t i = 0; i < order.size(); ++i) {
+		km += distanceKm(at, points[order[i]]);
+		at = points[order[i]];
+		latest = std::max(latest, waited[order[i]] + km / kSpeedKmh * 60 + i * kMinutesPerStop);
+	}
+	km += distanceKm(at, GeoPoint());
+	return latest;
+}
+
+// Plans trips for the orders waiting, or nothing if the window is still
+// open; flush plans whatever is waiting
+std::vector<DeliveryTrip> DeliveryPlanner::plan(bool flush) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (ready.empty() or !(flush or dueInMinutes(now) <= 0)) return {};
+	std::vector<GeoPoint> where;
+	std::vector<double> waited;
+	for (const Order& o : ready) {
+		where.push_back(locateAddress(o.getAddress()));
+		waited.push_back(minutesWaited(o, now));
+	}
+	std::vector<bool> assigned(ready.size());
+	std::vector<DeliveryTrip> trips;
+	for (size_t left = ready.size(); left > 0;) {
+		// The farthest open order seeds the group, its neighbours join it
+		size_t seed = 0;
+		double seedDist = -1;
+		for (size_t i = 0; i < ready.size(); ++i) {
+			if (!assigned[i] and distanceKm(GeoPoint(), where[i]) > seedDist) {
+				seed = i;
+				seedDist = distanceKm(GeoPoint(), where[i]);
+			}
+		}
+		std::vector<size_t> group = { seed };
+		std::vector<size_t> nearby;
+		for (size_t i = 0; i < ready.size(); ++i) {
+			if (!assigned[i] and i != seed and distanceKm(where[seed], where[i]) <= kGroupRadiusKm) nearby.push_back(i);
+		}
+		std::sort(nearby.begin(), nearby.end(), [&](size_t a, size_t b) {
+			return distanceKm(where[seed], where[a]) < distanceKm(where[seed], where[b]);
+		});
+		for (size_t i = 0; i < nearby.size() and group.size() < tripCapacity; ++i) {
+			group.push_back(nearby[i]);
+		}
+
+		std::vector<GeoPoint> points;
+		std::vector<double> waits;
+		std::vector<size_t> order;
+		double km = 0;
+		while (true) {
+			points.clear();
+			waits.clear();
+			for (size_t i : group) {
+				points.push_back(where[i]);
+				waits.push_back(waited[i]);
+			}
+			order = route(points);
+			if (arrivals(points, waits, order, km) <= promiseMinutes or group.size() == 1) break;
+			group.pop_back();
+		}
+
+		DeliveryTrip trip;
+		for (size_t i : order) {
+			trip.stops.push_back(ready[group[i]]);
+			assigned[group[i]] = true;
+			trip.soloKm += 2 * distanceKm(GeoPoint(), where[group[i]]);
+			trip.soloMinutes += 2 * distanceKm(GeoPoint(), where[group[i]]) / kSpeedKmh * 60 + kMinutesPerStop;
+		}
+		trip.km = km;
+		trip.minutes = km / kSpeedKmh * 60 + group.size() * kMinutesPerStop;
+		left -= group.size();
+		trips.push_back(std::move(trip));
+	}
+	ready.clear();
+	return trips;
+}
+
+void DeliveryPlanner::dispatched(const DeliveryTrip& trip, const std::string& courier) {
+	std::lock_guard<std::mutex> guard(lock);
+	byCourier[courier].first += trip.stops.size();
+	byCourier[courier].second += trip.km;
+	plannedKm += trip.km;
+	plannedMinutes += trip.minutes;
+	baselineKm += trip.soloKm;
+	baselineMinutes += trip.soloMinutes;
+	ordersPlanned += trip.stops.size();
+	++tripsPlanned;
+	for (const Order& o : trip.stops) {
+		readySince.erase(o.getId());
+	}
+}
+
+// A trip no courier could take. Its orders keep their ready time and are
+// planned again after one more window
+void DeliveryPlanner::putBack(const DeliveryTrip& trip) {
+	std::lock_guard<std::mutex> guard(lock);
+	++tripsWaiting;
+	ready.insert(ready.end(), trip.stops.begin(), trip.stops.end());
+	heldUntil = std::chrono::steady_clock::now() + std::chrono::microseconds((long long)(windowMinutes * millisPerMinute * 1000));
+}
+
+void DeliveryPlanner::printReport() const {
+	std::lock_guard<std::mutex> guard(lock);
+	std::cout << "Orders waiting for a trip: " << ready.size() << std::endl;
+	if (tripsWaiting != 0) std::cout << "Trips that found no free courier: " << tripsWaiting << std::endl;
+	if (ordersPlanned == 0) {
+		std::cout << "No deliveries made yet" << std::endl;
+		return;
+	}
+	std::cout << "Orders delivered: " << ordersPlanned << " in " << tripsPlanned << " trips" << std::endl;
+	std::cout << "Driven: " << plannedKm << " km, one order per trip would be " << baselineKm << " km" << std::endl;
+	std::cout << "Kilometres saved: " << baselineKm - plannedKm << std::endl;
+	std::cout << "Orders per courier-hour: " << ordersPlanned / (plannedMinutes / 60)
+		<< ", one order per trip: " << ordersPlanned / (baselineMinutes / 60) << std::endl;
+	for (const auto& entry : byCourier) {
+		std::cout << entry.first << ": " << entry.second.first << " orders, " << entry.second.second << " km" << std::endl;
+	}
+}
+
+void DeliveryPlanner::save(std::ofstream& out) const {
+	std::lock_guard<std::mutex> guard(lock);
+	out.write((char*)&ordersPlanned, sizeof(ordersPlanned));
+	out.write((char*)&tripsPlanned, sizeof(tripsPlanned));
+	for (double value : { plannedKm, plannedMinutes, baselineKm, baselineMinutes }) {
+		out.write((char*)&value, sizeof(double));
+	}
+}
+
+void DeliveryPlanner::load(std::ifstream& in) {
+	std::lock_guard<std::mutex> guard(lock);
+	in.read((char*)&ordersPlanned, sizeof(ordersPlanned));
+	in.read((char*)&tripsPlanned, sizeof(tripsPlanned));
+	for (double* value : { &plannedKm, &plannedMinutes, &baselineKm, &baselineMinutes }) {
+		in.read((char*)value, sizeof(double));
+	}
+}
+
+KitchenPipeline::KitchenPipeline() {
+	stations = {
+		{ "dough", 2, true, 3, 4 },
+		{ "toppings", 1.5, true, 3, 4 },
+		{ "oven", 8, false, 2, 4 },
+		{ "boxing", 0.5, true, 2, 4 },
+		{ "dispatch", 0.5, false, 1, 4 }
+	};
+	stats.reset(new StationStats[stations.size()]);
+}
+
+KitchenPipeline::~KitchenPipeline() {
+	{
+		std::lock_guard<std::mutex> guard(poolLock);
+		stopping = true;
+	}
+	poolWake.notify_all();
+	for (std::thread& t : pool) {
+		t.join();
+	}
+}
+
+// Makers beyond this number would have no slot to work at
+size_t KitchenPipeline::maxCrew() const {
+	size_t n = 0;
+	for (const KitchenStation& st : stations) {
+		if (st.manned) n += st.slots;
+	}
+	return n;
+}
+
+void KitchenPipeline::slotLoop(size_t station, size_t slot) {
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> guard(poolLock);
+	while (true) {
+		poolWake.wait(guard, [this, seen] { return stopping or generation != seen; });
+		if (stopping) return;
+		seen = generation;
+		guard.unlock();
+		job(station, slot);
+		guard.lock();
+		if (--active == 0) poolDone.notify_all();
+	}
+}
+
+// Feeds the orders `next` hands out through all stations until it returns
+// false, then lets the stations drain
+void KitchenPipeline::run(Source next, const std::vector<PizzaMaker>& crew, Callback onStart, Callback onDone) {
+	if (crew.empty()) return;
+	using clock = std::chrono::steady_clock;
+	auto micros = [](clock::duration d) { return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+
+	// Makers are dealt out over the free slots of the manned stations, the
+	// ones beyond maxCrew() stay idle; with a small crew one maker covers
+	// several stations
+	std::vector<std::vector<size_t>> staff(stations.size());
+	for (size_t m = 0, placed = 1; m < crew.size() and placed != 0;) {
+		placed = 0;
+		for (size_t i = 0; i < stations.size() and m < crew.size(); ++i) {
+			if (!stations[i].manned or staff[i].size() >= stations[i].slots) continue;
+			staff[i].push_back(m++);
+			++placed;
+		}
+	}
+	for (size_t i = 0, k = 0; i < stations.size(); ++i) {
+		if (stations[i].manned and staff[i].empty()) staff[i].push_back(k++ % crew.size());
+	}
+	// A maker's token is held while working, so shared makers never work two
+	// stations at once
+	std::unique_ptr<std::mutex[]> tokens(new std::mutex[crew.size()]);
+	std::unique_ptr<std::atomic<uint64_t>[]> makerJobs(new std::atomic<uint64_t>[crew.size()]());
+	std::unique_ptr<std::atomic<uint64_t>[]> makerUs(new std::atomic<uint64_t>[crew.size()]());
+
+	std::vector<std::unique_ptr<BoundedQueue<Order>>> queues;
+	for (const KitchenStation& st : stations) {
+		queues.push_back(std::make_unique<BoundedQueue<Order>>(st.queueCapacity));
+	}
+	std::unique_ptr<std::atomic<size_t>[]> running(new std::atomic<size_t>[stations.size()]);
+	for (size_t s = 0; s < stations.size(); ++s) {
+		running[s] = stations[s].manned ? staff[s].size() : stations[s].slots;
+	}
+	auto start = clock::now();
+	{
+		std::lock_guard<std::mutex> guard(poolLock);
+		if (pool.empty()) {
+			for (size_t s = 0; s < stations.size(); ++s) {
+				for (size_t w = 0; w < stations[s].slots; ++w) {
+					pool.emplace_back(&KitchenPipeline::slotLoop, this, s, w);
+				}
+			}
+		}
+		job = [&](size_t s, size_t w) {
+			bool staffed = stations[s].manned;
+			if (staffed and w >= staff[s].size()) return;
+			size_t maker = staffed ? staff[s][w] : 0;
+			StationStats& st = stats[s];
+			Order o;
+			while (queues[s]->pop(o)) {
+				if (s == 0) onStart(o);
+				size_t pizzas = orderPizzaCount(o);
+				std::unique_lock<std::mutex> token;
+				if (staffed) token = std::unique_lock<std::mutex>(tokens[maker]);
+				auto began = clock::now();
+				std::this_thread::sleep_for(std::chrono::microseconds((long long)(pizzas * stations[s].minutesPerPizza * kMillisPerMinute * 1000)));
+				uint64_t busy = micros(clock::now() - began);
+				st.busyUs += busy;
+				if (token) {
+					token.unlock();
+					makerJobs[maker] += 1;
+					makerUs[maker] += busy;
+				}
+				st.orders += 1;
+				st.pizzas += pizzas;
+				if (s + 1 == stations.size()) {
+					onDone(o);
+					continue;
+				}
+				auto waited = clock::now();
+				size_t fill = queues[s + 1]->push(std::move(o));
+				st.blockedUs += micros(clock::now() - waited);
+				stats[s + 1].queueSamples += 1;
+				stats[s + 1].queueFill += fill;
+			}
+			// The last worker to leave closes the next station's queue
+			if (--running[s] == 0 and s + 1 < stations.size()) queues[s + 1]->close();
+		};
+		active = pool.size();
+		++generation;
+	}
+	poolWake.notify_all();
+	Order o;
+	while (next(o)) {
+		stats[0].queueFill += queues[0]->push(std::move(o));
+		stats[0].queueSamples += 1;
+	}
+	queues[0]->close();
+	{
+		std::unique_lock<std::mutex> guard(poolLock);
+		poolDone.wait(guard, [this] { return active == 0; });
+		job = nullptr;
+	}
+	uint64_t elapsed = micros(clock::now() - start);
+	std::lock_guard<std::mutex> guard(lock);
+	wallUs += elapsed;
+	for (size_t s = 0; s < stations.size(); ++s) {
+		size_t count = stations[s].manned ? staff[s].size() : stations[s].slots;
+		stats[s].workerUs += elapsed * count;
+	}
+	for (size_t m = 0; m < crew.size(); ++m) {
+		byMaker[crew[m].getName()].first += makerJobs[m];
+		byMaker[crew[m].getName()].second += makerUs[m];
+	}
+}
+
+// Steady-state kitchen minutes per pizza in the model: the slowest station,
+// or the makers if the manned work outweighs it
+double KitchenPipeline::minutesPerPizza(size_t makers) const {
+	double manned = 0;
+	double slowest = 0;
+	for (const KitchenStation& st : stations) {
+		if (st.manned) manned += st.minutesPerPizza;
+		slowest = std::max(slowest, st.minutesPerPizza / st.slots);
+	}
+	return makers == 0 ? manned + slowest : std::max(slowest, manned / std::min(makers, maxCrew()));
+}
+
+// Busy is the share of worker time spent working, blocked the share spent
+// waiting for room in the next queue; the station with the highest busy
+// share and the fullest queue in front of it is the bottleneck
+void KitchenPipeline::printReport() const {
+	std::lock_guard<std::mutex> guard(lock);
+	if (wallUs == 0) {
+		std::cout << "The kitchen has not worked yet" << std::endl;
+		return;
+	}
+	double hours = wallUs / 1000.0 / kMillisPerMinute / 60;
+	std::cout << "Simulated kitchen time: " << hours * 60 << " min" << std::endl;
+	for (size_t s = 0; s < stations.size(); ++s) {
+		const StationStats& st = stats[s];
+		double workerUs = st.workerUs ? (double)st.workerUs : 1;
+		double avgQueue = st.queueSamples ? (double)st.queueFill / st.queueSamples : 0;
+		std::cout << stations[s].name << ": " << st.orders << " orders, " << st.pizzas / hours << " pizzas/hour, busy "
+			<< 100 * st.busyUs / workerUs << "%, blocked " << 100 * st.blockedUs / workerUs << "%, queue "
+			<< avgQueue << "/" << stations[s].queueCapacity << std::endl;
 	}
-	size_t workerCount;
-	in.read((char*)&workerCount, sizeof(size_t));
-	couriers.resize(workerCount);
-	for (size_t i = 0; i < workerCount; ++i) {
-		DeliveryMan employee;
-		size_t nameLen = 20;
-		in.read((char*)&nameLen, sizeof(size_t));
-		std::string name(nameLen, '\0');
-		in.read(&name[0], nameLen);
-		employee.setName(name);
-		couriers[i] = employee;
+	for (const auto& entry : byMaker) {
+		std::cout << entry.first << ": " << entry.second.first << " station jobs, "
+			<< entry.second.second / 1000.0 / kMillisPerMinute << " min at work" << std::endl;
 	}
-	in.close();
+}
 
-	//  ClientAdresses
-	in.open("ClientAddresses.bin", std::ios::binary);
-	if (!in) {
-		std::cout << "Failed to open ClientAddresses.bin for reading." << std::endl;
-		return;
-	}
-	if (in.peek() == std::ifstream::traits_type::eof()) {
-		return;
+void KitchenPipeline::save(std::ofstream& out) const {
+	std::lock_guard<std::mutex> guard(lock);
+	size_t count = stations.size();
+	out.write((char*)&wallUs, sizeof(wallUs));
+	out.write((char*)&count, sizeof(size_t));
+	for (size_t s = 0; s < count; ++s) {
+		uint64_t values[] = { stats[s].orders, stats[s].pizzas, stats[s].busyUs, stats[s].blockedUs,
+			stats[s].queueSamples, stats[s].queueFill, stats[s].workerUs };
+		out.write((char*)values, sizeof(values));
 	}
-	size_t clientAdrSize;
-	in.read((char*)&clientAdrSize, sizeof(size_t));
-	clientAddresses.clear();
-	for (size_t i = 0; i < clientAdrSize; ++i) {
-		size_t keyLen, valueLen;
-		in.read((char*)&keyLen, sizeof(size_t));
-		std::string key(keyLen, '\0');
-		in.read(&key[0], keyLen);
+}
 
-		in.read((char*)&valueLen, sizeof(size_t));
-		std::string value(valueLen, '\0');
-		in.read(&value[0], valueLen);
+void KitchenPipeline::load(std::ifstream& in) {
+	std::lock_guard<std::mutex> guard(lock);
+	size_t count = 0;
+	in.read((char*)&wallUs, sizeof(wallUs));
+	in.read((char*)&count, sizeof(size_t));
+	for (size_t s = 0; s < count and s < stations.size() and in; ++s) {
+		uint64_t values[7];
+		in.read((char*)values, sizeof(values));
+		stats[s].orders = values[0];
+		stats[s].pizzas = values[1];
+		stats[s].busyUs = values[2];
+		stats[s].blockedUs = values[3];
+		stats[s].queueSamples = values[4];
+		stats[s].queueFill = values[5];
+		stats[s].workerUs = values[6];
+	}
+}
 
-		clientAddresses[key] = value;
+const char* decisionName(AdmissionDecision d) {
+	switch (d) {
+	case AdmissionDecision::Accept:
+		return "accept";
+	case AdmissionDecision::Defer:
+		return "defer";
+	case AdmissionDecision::Reject:
+		return "reject";
+	case AdmissionDecision::Declined:
+		return "declined";
 	}
-	in.close();
+	return "unknown";
+}
 
-	in.open("ClientData.bin", std::ios::binary);
-	if (!in) {
-		std::cout << "Failed to open ClientData.bin for reading." << std::endl;
-		return;
+AdmissionController::AdmissionController(const std::string& logPath) : logPath(logPath) {}
+
+// Makers work the queued pizzas in parallel, couriers take the ready orders
+// in trips of up to tripCapacity. An accepted order waits behind the accepted
+// work only, a deferred one also behind the orders deferred before it
+AdmissionQuote AdmissionController::quote(size_t queuedOrders, size_t acceptedPizzas, size_t deferredPizzas, size_t orderPizzas, size_t makers, size_t couriers, size_t tripCapacity) const {
+	std::lock_guard<std::mutex> guard(lock);
+	AdmissionQuote q;
+	q.queuedOrders = queuedOrders;
+	q.makers = makers;
+	q.couriers = couriers;
+	if (makers == 0 or couriers == 0) {
+		q.decision = AdmissionDecision::Reject;
+		q.waitMinutes = -1;
+		return q;
 	}
-	if (in.peek() == std::ifstream::traits_type::eof()) {
-		return;
+	double perPizza = minutesPerPizza * measuredScale;
+	double rounds = std::ceil((double)(queuedOrders + 1) / (couriers * tripCapacity));
+	q.waitMinutes = (acceptedPizzas + orderPizzas) * perPizza + rounds * minutesPerTrip;
+	if (q.waitMinutes <= budgetMinutes) {
+		q.decision = AdmissionDecision::Accept;
+		return q;
 	}
-	size_t clientDataSize;
-	in.read((char*)&clientDataSize, sizeof(size_t));
-	clientLogins.clear();
-	for (size_t i = 0; i < clientDataSize; ++i) {
-		size_t keyLen, valueLen;
-		in.read((char*)&keyLen, sizeof(size_t));
-		std::string key(keyLen, '\0');
-		in.read(&key[0], keyLen);
-
-		in.read((char*)&valueLen, sizeof(size_t));
-		std::string value(valueLen, '\0');
-		in.read(&value[0], valueLen);
-
-		clientLogins[key] = value;
+	if (acceptedPizzas == 0 and deferredPizzas == 0) {
+		q.overBudget = true;
+		q.decision = q.waitMinutes <= deferBudgetMinutes ? AdmissionDecision::Accept : AdmissionDecision::Reject;
+		return q;
 	}
-	in.close();
+	q.startMinutes = (acceptedPizzas + deferredPizzas) * perPizza;
+	q.waitMinutes += deferredPizzas * perPizza;
+	q.decision = q.waitMinutes <= deferBudgetMinutes ? AdmissionDecision::Defer : AdmissionDecision::Reject;
+	return q;
+}
 
-	//  Reviews
-	in.open("Reviews.bin", std::ios::binary);
-	if (!in) {
-		std::cout << "Failed to open Reviews.bin for reading." << std::endl;
+void AdmissionController::record(const Order& o, const AdmissionQuote& q) const {
+	std::lock_guard<std::mutex> guard(lock);
+	bool fresh = !std::filesystem::exists(logPath);
+	std::ofstream out(logPath, std::ios::app);
+	if (!out) {
+		std::cout << "Failed to open " << logPath << " for writing." << std::endl;
 		return;
 	}
-	if (in.peek() == std::ifstream::traits_type::eof()) {
-		return;
+	if (fresh) out << "time,order_id,login,pizzas,queued_orders,makers,couriers,wait_minutes,budget_minutes,decision\n";
+	long long now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	out << now << ',' << o.getId() << ',' << o.getClientLogin() << ',' << orderPizzaCount(o) << ',' << q.queuedOrders << ','
+		<< q.makers << ',' << q.couriers << ',' << q.waitMinutes << ',' << budgetMinutes << ',' << decisionName(q.decision) << '\n';
+}
+
+void AdmissionController::setKitchenRate(double minutes) {
+	std::lock_guard<std::mutex> guard(lock);
+	minutesPerPizza = minutes;
+}
+
+// An order took minutes from entering the kitchen queue to ready, and the
+// quote had it wait for pizzas, its own included
+void AdmissionController::observeKitchen(double minutes, size_t pizzas) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (pizzas == 0 or minutesPerPizza <= 0) return;
+	measuredScale += kSmoothing * (minutes / (pizzas * minutesPerPizza) - measuredScale);
+}
+
+// Trip durations are not measured, this averages the planner's estimates
+void AdmissionController::notePlannedTrip(double minutes) {
+	std::lock_guard<std::mutex> guard(lock);
+	minutesPerTrip += kSmoothing * (minutes - minutesPerTrip);
+}
+
+void AdmissionController::setBudgets(double budget, double deferBudget) {
+	std::lock_guard<std::mutex> guard(lock);
+	budgetMinutes = budget;
+	deferBudgetMinutes = std::max(budget, deferBudget);
+}
+
+void AdmissionController::printSettings() const {
+	std::lock_guard<std::mutex> guard(lock);
+	std::cout << "Latency budget: " << budgetMinutes << " min, deferring up to " << deferBudgetMinutes << " min" << std::endl;
+	std::cout << "Estimates: " << minutesPerPizza * measuredScale << " min per pizza (model " << minutesPerPizza
+		<< ", measured x" << measuredScale << "), " << minutesPerTrip << " min per planned delivery trip" << std::endl;
+	std::cout << "Decisions are logged to " << logPath << std::endl;
+}
+
+void AdmissionController::save(std::ofstream& out) const {
+	std::lock_guard<std::mutex> guard(lock);
+	for (double value : { budgetMinutes, deferBudgetMinutes, minutesPerPizza, minutesPerTrip, measuredScale }) {
+		out.write((char*)&value, sizeof(double));
 	}
-	size_t reviewCount;
-	in.read((char*)&reviewCount, sizeof(size_t));
-	feedbackReceiver.getReviews().resize(reviewCount);
-	for (size_t i = 0; i < reviewCount; ++i) {
-		std::string temp;
-		size_t nameLen;
-		in.read((char*)&nameLen, sizeof(size_t));
-		std::string review(nameLen, '\0');
-		in.read(&review[0], nameLen);
-		feedbackReceiver.getReviews()[i] = review;	
+}
+
+void AdmissionController::load(std::ifstream& in) {
+	std::lock_guard<std::mutex> guard(lock);
+	for (double* value : { &budgetMinutes, &deferBudgetMinutes, &minutesPerPizza, &minutesPerTrip }) {
+		in.read((char*)value, sizeof(double));
 	}
-	in.close();
+	// Files written before the scale was measured end here
+	if (!in.read((char*)&measuredScale, sizeof(double))) measuredScale = 1;
 }
 
 void PizzeriaDB::paymentProcess(const Order& o) {
@@ -599,18 +3067,539 @@ void PizzeriaDB::getFeedback(const std::string& client_name) {
 		std::cin.ignore();
 		std::getline(std::cin, temp);
 		feedbackReceiver.receiveFeedback(client_name, temp);
+		journal.append({ 0, MutationType::AddReview, client_name, temp });
 	}
 }
 
-Employee::Employee(const std::string& name, bool free) : name(name), free(free) {}
+const ReplicationJournal& PizzeriaDB::getJournal() const {
+	return journal;
+}
 
-void PizzaMaker::makePizza(const Order& o) {
-	free = false;
-	std::cout << "Worker " << this->name << " is working" << std::endl;
-	std::cout << "Worker has finished" << std::endl;
-	free = true;
+const ClientIndex& PizzeriaDB::getClientIndex() const {
+	return clients;
+}
+
+DBSnapshot PizzeriaDB::takeSnapshot() const {
+	DBSnapshot snap;
+	snap.seq = journal.getLastSeq();
+	snap.AdminKey = AdminKey;
+	snap.availablePizzas = *availablePizzas.load();
+	SnapshotReader<std::vector<PizzaMaker>> makers = pizzaMakers.list();
+	for (const auto& worker : *makers) {
+		snap.pizzaMakers.push_back(worker.getName());
+	}
+	SnapshotReader<std::vector<DeliveryMan>> riders = couriers.list();
+	for (const auto& worker : *riders) {
+		snap.couriers.push_back(worker.getName());
+	}
+	snap.clients = clients.pendingChanges();
+	snap.reviews = feedbackReceiver.getReviews();
+	return snap;
+}
+
+std::string encodeMutation(const Mutation& m) {
+	std::string buf;
+	auto putString = [&buf](const std::string& s) {
+		size_t len = s.size();
+		buf.append((const char*)&len, sizeof(size_t));
+		buf.append(s);
+	};
+	buf.append((const char*)&m.seq, sizeof(m.seq));
+	buf.push_back((char)m.type);
+	putString(m.key);
+	putString(m.value);
+	buf.append((const char*)&m.price, sizeof(double));
+	return buf;
+}
+
+bool decodeMutation(const std::string& buf, size_t& pos, Mutation& m) {
+	auto get = [&buf, &pos](void* dst, size_t len) {
+		if (buf.size() - pos < len) return false;
+		std::memcpy(dst, buf.data() + pos, len);
+		pos += len;
+		return true;
+	};
+	auto getString = [&buf, &pos, &get](std::string& s) {
+		size_t len;
+		if (!get(&len, sizeof(size_t)) or buf.size() - pos < len) return false;
+		s.assign(buf, pos, len);
+		pos += len;
+		return true;
+	};
+	unsigned char type;
+	if (!get(&m.seq, sizeof(m.seq)) or !get(&type, 1)) return false;
+	m.type = (MutationType)type;
+	return getString(m.key) and getString(m.value) and get(&m.price, sizeof(double));
+}
+
+ReplicationJournal::ReplicationJournal(size_t capacity) : capacity(capacity) {}
+
+unsigned long long ReplicationJournal::append(Mutation m) {
+	std::lock_guard<std::mutex> guard(lock);
+	m.seq = ++lastSeq;
+	records.push_back(encodeMutation(m));
+	if (records.size() > capacity) records.pop_front();
+	return m.seq;
+}
+
+unsigned long long ReplicationJournal::getLastSeq() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return lastSeq;
+}
+
+// Appends every record after seq to stream. Fails if some of them were
+// already dropped from the journal
+bool ReplicationJournal::readSince(unsigned long long seq, std::string& stream) const {
+	std::lock_guard<std::mutex> guard(lock);
+	unsigned long long firstSeq = lastSeq - records.size() + 1;
+	if (seq + 1 < firstSeq) return false;
+	for (size_t i = seq + 1 - firstSeq; i < records.size(); ++i) {
+		stream += records[i];
+	}
+	return true;
+}
+
+PizzeriaReplica::PizzeriaReplica(std::shared_ptr<const PizzeriaDB> primary, unsigned long long maxLag, std::chrono::milliseconds maxDelay)
+	: primary(primary), maxLag(maxLag), maxDelay(maxDelay), lastSync(std::chrono::steady_clock::now()) {
+	clientFile = primary->getClientIndex().openReader();
+	clientFileGeneration = clientFile->getGeneration();
+	state = primary->takeSnapshot();
+	catalogue.publish(state.availablePizzas);
+	syncer = std::thread(&PizzeriaReplica::syncLoop, this);
+}
+
+PizzeriaReplica::~PizzeriaReplica() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	syncer.join();
+}
+
+// Wakes a few times per maxDelay, so the time bound holds without a read
+// having to trigger the catch-up
+void PizzeriaReplica::syncLoop() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (!stopping) {
+		syncIfStale();
+		wake.wait_for(guard, maxDelay / 4);
+	}
+}
+
+void PizzeriaReplica::apply(const Mutation& m) {
+	switch (m.type) {
+	case MutationType::AddClient:
+		state.clients[m.key].password = m.value;
+		break;
+	case MutationType::SaveAddress:
+		state.clients[m.key].address = m.value;
+		break;
+	case MutationType::AddPizza:
+		state.availablePizzas.emplace_back(m.key, m.price);
+		break;
+	case MutationType::DeletePizza:
+		std::erase_if(state.availablePizzas, [&m](Pizza& p) { return p.getPizzaType() == m.key; });
+		break;
+	case MutationType::AddPizzaMaker:
+		state.pizzaMakers.push_back(m.key);
+		break;
+	case MutationType::AddCourier:
+		state.couriers.push_back(m.key);
+		break;
+	case MutationType::DeletePizzaMaker:
+		std::erase(state.pizzaMakers, m.key);
+		break;
+	case MutationType::DeleteCourier:
+		std::erase(state.couriers, m.key);
+		break;
+	case MutationType::AddReview:
+		state.reviews.push_back(m.key + ": " + m.value);
+		break;
+	case MutationType::SetAdminKey:
+		state.AdminKey = m.key;
+		break;
+	}
+	state.seq = m.seq;
+}
+
+void PizzeriaReplica::catchUp() {
+	lastSync = std::chrono::steady_clock::now();
+	std::string stream;
+	if (!primary->getJournal().readSince(state.seq, stream)) {
+		++snapshotReloads;
+		state = primary->takeSnapshot();
+		catalogue.publish(state.availablePizzas);
+		return;
+	}
+	size_t pos = 0;
+	Mutation m;
+	bool menuChanged = false;
+	while (pos < stream.size() and decodeMutation(stream, pos, m)) {
+		if (m.seq != state.seq + 1) continue;
+		apply(m);
+		menuChanged |= m.type == MutationType::AddPizza or m.type == MutationType::DeletePizza;
+	}
+	if (menuChanged) catalogue.publish(state.availablePizzas);
+}
+
+void PizzeriaReplica::syncIfStale() {
+	unsigned long long lag = primary->getJournal().getLastSeq() - state.seq;
+	if (lag > maxLag or (lag != 0 and std::chrono::steady_clock::now() - lastSync >= maxDelay)) catchUp();
+	trimClients();
+}
+
+// After a merge, overlay entries the file already holds are dropped, so the
+// overlay only keeps what is still waiting for the next merge
+void PizzeriaReplica::trimClients() {
+	unsigned long long generation = clientFile->getGeneration();
+	if (generation == clientFileGeneration) return;
+	clientFileGeneration = generation;
+	std::erase_if(state.clients, [this](const auto& entry) {
+		ClientRecord rec;
+		if (!clientFile->find(entry.first, rec)) return false;
+		return (entry.second.password.empty() or entry.second.password == rec.password)
+			and (entry.second.address.empty() or entry.second.address == rec.address);
+	});
+}
+
+unsigned long long PizzeriaReplica::getAppliedSeq() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return state.seq;
+}
+
+unsigned long long PizzeriaReplica::getSnapshotReloads() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return snapshotReloads;
+}
+
+unsigned long long PizzeriaReplica::getLag() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return primary->getJournal().getLastSeq() - state.seq;
+}
+
+SnapshotReader<std::vector<Pizza>> PizzeriaReplica::getPizzasAvailable() const {
+	return catalogue.load();
+}
+
+void PizzeriaReplica::readFeedbacks() {
+	std::lock_guard<std::mutex> guard(lock);
+	syncIfStale();
+	for (const auto& now : state.reviews) {
+		std::cout << now << std::endl;
+	}
+}
+
+// Replica view of a client: the on-disk index, read through the replica's
+// own handle, overlaid with the changes this replica has applied
+bool PizzeriaReplica::findClient(const std::string& login, ClientRecord& rec) const {
+	bool found = clientFile->find(login, rec);
+	auto it = state.clients.find(login);
+	if (it == state.clients.end()) return found;
+	if (!it->second.password.empty()) rec.password = it->second.password;
+	if (!it->second.address.empty()) rec.address = it->second.address;
+	return true;
+}
+
+bool PizzeriaReplica::ClientIsValid(const std::string& l, const std::string& p) {
+	std::lock_guard<std::mutex> guard(lock);
+	syncIfStale();
+	ClientRecord rec;
+	return findClient(l, rec) and rec.password == p;
+}
+
+std::string PizzeriaReplica::getClientAddress(const std::string& l) {
+	std::lock_guard<std::mutex> guard(lock);
+	syncIfStale();
+	ClientRecord rec;
+	if (findClient(l, rec) and !rec.address.empty())
+		return rec.address;
+	else return "Unknown";
+}
+
+ClientIndex::ClientIndex(const std::string& path) : path(path) {}
+
+ClientIndex::~ClientIndex() {
+	if (merger.joinable()) merger.join();
+}
+
+bool ClientIndex::open() {
+	std::lock_guard<std::mutex> guard(lock);
+	return file.open(path);
+}
+
+// Header: record count and offset of the sparse index, then the records,
+// then the sparse index itself
+bool ClientIndexFile::open(const std::string& path) {
+	close();
+	in.open(path, std::ios::binary);
+	if (!in) return false;
+	long long indexOffset;
+	in.read((char*)&count, sizeof(size_t));
+	in.read((char*)&indexOffset, sizeof(long long));
+	in.seekg(indexOffset);
+	size_t blockCount = 0;
+	in.read((char*)&blockCount, sizeof(size_t));
+	for (size_t i = 0; i < blockCount and in; ++i) {
+		size_t keyLen;
+		in.read((char*)&keyLen, sizeof(size_t));
+		std::string key(keyLen, '\0');
+		in.read(&key[0], keyLen);
+		long long offset;
+		in.read((char*)&offset, sizeof(long long));
+		blocks.emplace_back(key, offset);
+	}
+	if (!in) {
+		std::cout << "Failed to read " << path << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void ClientIndexFile::close() {
+	in.close();
+	in.clear();
+	blocks.clear();
+	count = 0;
+}
+
+static void writeClientRecord(std::ofstream& out, const std::string& login, const ClientRecord& rec) {
+	for (const std::string* field : { &login, &rec.password, &rec.address }) {
+		size_t len = field->size();
+		out.write((char*)&len, sizeof(size_t));
+		out.write(field->c_str(), len);
+	}
+}
+
+static bool readClientRecord(std::istream& in, std::string& login, ClientRecord& rec) {
+	for (std::string* field : { &login, &rec.password, &rec.address }) {
+		size_t len;
+		if (!in.read((char*)&len, sizeof(size_t))) return false;
+		field->resize(len);
+		if (!in.read(&(*field)[0], len)) return false;
+	}
+	return true;
+}
+
+bool ClientIndexFile::find(const std::string& login, ClientRecord& rec) {
+	auto it = std::upper_bound(blocks.begin(), blocks.end(), login,
+		[](const std::string& key, const std::pair<std::string, long long>& block) { return key < block.first; });
+	if (it == blocks.begin()) return false;
+	--it;
+	size_t block = it - blocks.begin();
+	size_t records = std::min(kBlockRecords, count - block * kBlockRecords);
+	in.clear();
+	in.seekg(it->second);
+	std::string key;
+	ClientRecord found;
+	for (size_t i = 0; i < records and readClientRecord(in, key, found); ++i) {
+		if (key == login) {
+			rec = found;
+			return true;
+		}
+		if (key > login) break;
+	}
+	return false;
+}
+
+bool ClientIndex::findLocked(const std::string& login, ClientRecord& rec) const {
+	for (const auto* changes : { &delta, &merging }) {
+		auto it = changes->find(login);
+		if (it != changes->end()) {
+			rec = it->second;
+			return true;
+		}
+	}
+	return file.find(login, rec);
+}
+
+bool ClientIndex::find(const std::string& login, ClientRecord& rec) const {
+	std::lock_guard<std::mutex> guard(lock);
+	return findLocked(login, rec);
+}
+
+std::shared_ptr<ClientIndexReader> ClientIndex::openReader() const {
+	std::lock_guard<std::mutex> guard(lock);
+	std::erase_if(readers, [](const std::weak_ptr<ClientIndexReader>& r) { return r.expired(); });
+	std::shared_ptr<ClientIndexReader> reader = std::make_shared<ClientIndexReader>();
+	reader->file.open(path);
+	reader->generation = generation;
+	readers.push_back(reader);
+	return reader;
+}
+
+bool ClientIndexReader::find(const std::string& login, ClientRecord& rec) const {
+	std::lock_guard<std::mutex> guard(lock);
+	return file.find(login, rec);
+}
+
+unsigned long long ClientIndexReader::getGeneration() const {
+	return generation.load(std::memory_order_acquire);
+}
+
+void ClientIndex::put(const std::string& login, const ClientRecord& rec) {
+	delta[login] = rec;
+	if (delta.size() < kMergeThreshold or !merging.empty()) return;
+	if (merger.joinable()) merger.join();
+	merging = std::move(delta);
+	delta.clear();
+	merger = std::thread(&ClientIndex::runMerge, this);
+}
+
+void ClientIndex::setPassword(const std::string& login, const std::string& password) {
+	std::lock_guard<std::mutex> guard(lock);
+	ClientRecord rec;
+	findLocked(login, rec);
+	rec.password = password;
+	put(login, rec);
+}
+
+void ClientIndex::setAddress(const std::string& login, const std::string& address) {
+	std::lock_guard<std::mutex> guard(lock);
+	ClientRecord rec;
+	findLocked(login, rec);
+	rec.address = address;
+	put(login, rec);
+}
+
+// Writes the base file merged with `merging` into a new file and swaps it in
+void ClientIndex::runMerge() {
+	std::vector<std::pair<std::string, ClientRecord>> changes;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		changes.assign(merging.begin(), merging.end());
+	}
+	std::sort(changes.begin(), changes.end(), [](auto& a, auto& b) { return a.first < b.first; });
+
+	std::string tmpPath = path + ".tmp";
+	std::ifstream old(path, std::ios::binary);
+	size_t oldCount = 0;
+	if (old) {
+		long long skip;
+		old.read((char*)&oldCount, sizeof(size_t));
+		old.read((char*)&skip, sizeof(long long));
+		if (!old) oldCount = 0;
+	}
+	std::ofstream out(tmpPath, std::ios::binary | std::ios::out);
+	if (!out) {
+		std::cout << "Failed to open " << tmpPath << " for writing." << std::endl;
+		// Keep the changes pending, newer ones in delta win
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto& entry : merging) {
+			delta.try_emplace(entry.first, entry.second);
+		}
+		merging.clear();
+		return;
+	}
+	size_t count = 0;
+	long long indexOffset = 0;
+	out.write((char*)&count, sizeof(size_t));
+	out.write((char*)&indexOffset, sizeof(long long));
+	std::vector<std::pair<std::string, long long>> newBlocks;
+	auto emit = [&](const std::string& login, const ClientRecord& rec) {
+		if (count % ClientIndexFile::kBlockRecords == 0) newBlocks.emplace_back(login, (long long)out.tellp());
+		writeClientRecord(out, login, rec);
+		++count;
+	};
+	std::string key;
+	ClientRecord rec;
+	bool haveOld = oldCount != 0 and readClientRecord(old, key, rec);
+	size_t oldRead = haveOld ? 1 : 0;
+	size_t next = 0;
+	while (haveOld or next < changes.size()) {
+		if (!haveOld or (next < changes.size() and changes[next].first <= key)) {
+			if (haveOld and changes[next].first == key) {
+				haveOld = oldRead < oldCount and readClientRecord(old, key, rec);
+				if (haveOld) ++oldRead;
+			}
+			emit(changes[next].first, changes[next].second);
+			++next;
+		}
+		else {
+			emit(key, rec);
+			haveOld = oldRead < oldCount and readClientRecord(old, key, rec);
+			if (haveOld) ++oldRead;
+		}
+	}
+	old.close();
+	indexOffset = out.tellp();
+	size_t blockCount = newBlocks.size();
+	out.write((char*)&blockCount, sizeof(size_t));
+	for (const auto& block : newBlocks) {
+		size_t keyLen = block.first.size();
+		out.write((char*)&keyLen, sizeof(size_t));
+		out.write(block.first.c_str(), keyLen);
+		out.write((char*)&block.second, sizeof(long long));
+	}
+	out.seekp(0);
+	out.write((char*)&count, sizeof(size_t));
+	out.write((char*)&indexOffset, sizeof(long long));
+	out.close();
+
+	// Every handle is closed for the swap, an open one keeps the old file busy on Windows
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<std::shared_ptr<ClientIndexReader>> open;
+	std::vector<std::unique_lock<std::mutex>> held;
+	for (const auto& weak : readers) {
+		if (std::shared_ptr<ClientIndexReader> reader = weak.lock()) {
+			held.emplace_back(reader->lock);
+			reader->file.close();
+			open.push_back(reader);
+		}
+	}
+	file.close();
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, path, ec);
+	if (ec) std::cout << "Failed to replace " << path << ": " << ec.message() << std::endl;
+	file.open(path);
+	++generation;
+	for (const auto& reader : open) {
+		reader->file.open(path);
+		reader->generation.store(generation, std::memory_order_release);
+	}
+	merging.clear();
+}
+
+// Folds every pending change into the file before returning
+void ClientIndex::merge() {
+	std::unique_lock<std::mutex> guard(lock);
+	if (merger.joinable()) {
+		guard.unlock();
+		merger.join();
+		guard.lock();
+	}
+	if (delta.empty()) return;
+	merging = std::move(delta);
+	delta.clear();
+	guard.unlock();
+	runMerge();
+}
+
+void ClientIndex::build(const std::unordered_map<std::string, std::string>& logins, const std::unordered_map<std::string, std::string>& addresses) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (const auto& entry : logins) {
+			delta[entry.first].password = entry.second;
+		}
+		for (const auto& entry : addresses) {
+			delta[entry.first].address = entry.second;
+		}
+	}
+	merge();
+}
+
+std::unordered_map<std::string, ClientRecord> ClientIndex::pendingChanges() const {
+	std::lock_guard<std::mutex> guard(lock);
+	std::unordered_map<std::string, ClientRecord> changes = merging;
+	for (const auto& entry : delta) {
+		changes[entry.first] = entry.second;
+	}
+	return changes;
 }
 
+Employee::Employee(const std::string& name, bool free) : name(name), free(free) {}
+
 void DeliveryMan::deliver(const Order& o) {
 	free = false;
 	std::cout << "Courier " << this->name << " is delireving to " << o.getClientName() << " on address: " << o.getAddress() << std::endl;
@@ -668,6 +3657,7 @@ void Client::makeOrder(std::shared_ptr<PizzeriaDB> p) {
 	system("CLS");
 	std::string temp;
 	Order this_order;
+	this_order.setClientLogin(this->login);
 	std::cout << "Enter your name: ";
 	std::cin >> temp;
 	this_order.setClientName(temp);
@@ -689,8 +3679,18 @@ void Client::makeOrder(std::shared_ptr<PizzeriaDB> p) {
 		p->saveAddress(this->login, temp);
 		break;
 	}
+	auto printList = [](const std::string& title, const std::vector<std::string>& names) {
+		if (names.empty()) return;
+		std::cout << title;
+		for (size_t i = 0; i < names.size(); ++i) {
+			std::cout << (i ? ", " : "") << names[i];
+		}
+		std::cout << std::endl;
+	};
+	printList("Most popular: ", p->getPopularPizzas(3));
 	std::cout << "Choose your pizza: " << std::endl;
-	std::vector<Pizza> menu = std::move(p->getPizzasAvailable());
+	SnapshotReader<std::vector<Pizza>> catalogue = replica->getPizzasAvailable();
+	const std::vector<Pizza>& menu = *catalogue;
 	char c = 'y';
 	while (c == 'y') {
 		for (int i = 0; i < menu.size(); i++) {
@@ -699,23 +3699,77 @@ void Client::makeOrder(std::shared_ptr<PizzeriaDB> p) {
 		int pizza_number = inputInt("Enter number of your pizza", 1, menu.size());
 		int amount = inputInt("Enter amount", 1);
 		this_order.addPizza(menu[pizza_number - 1].getPizzaType(), menu[pizza_number - 1].getPrice(), amount);
+		printList("Often ordered with it: ", p->getOrderedWith(menu[pizza_number - 1].getPizzaType(), 3));
 		std::cout << "Wanna add more? y/n" << std::endl;
 		std::cin >> c;
 	}
-	p->newOrder(this_order);
+	AdmissionQuote quote = p->quoteOrder(this_order);
+	if (quote.decision != AdmissionDecision::Reject) {
+		if (quote.decision == AdmissionDecision::Defer)
+			std::cout << "We are very busy, your order will be started in about " << (int)std::ceil(quote.startMinutes) << " min" << std::endl;
+		if (quote.overBudget)
+			std::cout << "This is a big order, it will take longer than usual" << std::endl;
+		std::cout << "Estimated waiting time: " << (int)std::ceil(quote.waitMinutes) << " min. Continue? y/n" << std::endl;
+		std::cin >> c;
+		if (c != 'y') {
+			p->declineOrder(this_order, quote);
+			return;
+		}
+	}
+	if (!status) status = std::make_unique<StatusSubscription>(p->getStatusBus().subscribeClient(this->login));
+	uint64_t from = p->getStatusBus().position();
+	unsigned long long orderId = p->newOrder(this_order, quote);
+	if (orderId == 0) {
+		std::cout << "Sorry, the kitchen is full right now, please try again later" << std::endl;
+		return;
+	}
 	std::cout << "Your total is: " << this_order.getOrderPrice() << std::endl;
 	p->paymentProcess(this_order);
 	system("CLS");
-	std::cout << "Your order is now in work" << std::endl;
+	std::cout << "Your order #" << orderId << " is now in work, its status is shown above the menu" << std::endl;
 	p->complete_order();
+	bool waited = false;
+	if (!p->getPizzaMakers()->empty() and !p->getCouriers()->empty()) {
+		std::cout << "Wait here until it is delivered? y/n" << std::endl;
+		std::cin >> c;
+		waited = c == 'y';
+		if (waited) waitForDelivery(p, orderId, from);
+	}
+	printStatusUpdates(waited ? orderId : 0);
 	p->getFeedback(this_order.getClientName());
 
 	system("CLS");
 }
 
+// Stage changes of this client's orders since the last call, except for
+// skipOrder, whose changes were already shown
+void Client::printStatusUpdates(unsigned long long skipOrder) {
+	if (!status) return;
+	OrderEvent event;
+	while (status->tryNext(event)) {
+		if (event.orderId != skipOrder) std::cout << "Order #" << event.orderId << " is " << stageName(event.stage) << std::endl;
+	}
+	if (status->getMissed() != missedShown) {
+		std::cout << "Some status updates were lost, the kitchen was too busy" << std::endl;
+		missedShown = status->getMissed();
+	}
+}
+
+// Follows one order stage by stage, sleeping between events
+void Client::waitForDelivery(std::shared_ptr<PizzeriaDB> p, unsigned long long orderId, uint64_t from) {
+	StatusSubscription watch = p->getStatusBus().subscribeOrder(orderId, from);
+	OrderEvent event;
+	do {
+		watch.next(event);
+		std::cout << "Order #" << orderId << " is " << stageName(event.stage) << std::endl;
+	} while (event.stage != OrderStage::Delivered and watch.getMissed() == 0);
+	if (event.stage != OrderStage::Delivered) std::cout << "Some status updates were lost, the status is shown above the menu" << std::endl;
+}
+
 void Client::MainMenu(std::shared_ptr<PizzeriaDB> db) {
 	system("CLS");
 	while (true) {
+		printStatusUpdates();
 		std::cout << "1 - Make order\n2 - List of Pizzas\n3 - Read reviews\n4 - Exit\n";
 		int num = inputInt("Choose number", 1, 4);
 		std::string s;
@@ -724,14 +3778,15 @@ void Client::MainMenu(std::shared_ptr<PizzeriaDB> db) {
 			this->makeOrder(db);
 			break;
 		case 2: {
-			std::vector<Pizza> menu = std::move(db->getPizzasAvailable());
+			SnapshotReader<std::vector<Pizza>> catalogue = replica->getPizzasAvailable();
+			const std::vector<Pizza>& menu = *catalogue;
 			for (int i = 0; i < menu.size(); i++) {
 				std::cout << i + 1 << " " << menu[i].getPizzaType() << " " << menu[i].getPrice() << std::endl;
 			}
 			break;
 		}
 		case 3:
-			db->readFeedbacks();
+			replica->readFeedbacks();
 			break;
 		case 4:
 			return;
@@ -743,12 +3798,13 @@ void Client::MainMenu(std::shared_ptr<PizzeriaDB> db) {
 void Admin::MainMenu(std::shared_ptr<PizzeriaDB> db) {
 	system("CLS");
 	while (true) {
-		std::cout << "1 - List of pizzas\n2 - Add pizza\n3 - Delete pizza\n4 - List of pizzamakers\n5 - List of couriers\n6 - Add employee\n7 - Delete employee\n8 - Change admin key\n9 - Exit\n";
-		int num = inputInt("Choose number", 1, 9);
+		std::cout << "1 - List of pizzas\n2 - Add pizza\n3 - Delete pizza\n4 - List of pizzamakers\n5 - List of couriers\n6 - Add employee\n7 - Delete employee\n8 - Change admin key\n9 - Replication status\n10 - Delivery statistics\n11 - Admission control\n12 - Kitchen statistics\n13 - Exit\n";
+		int num = inputInt("Choose number", 1, 13);
 		std::string s;
 		switch (num) {
 		case 1: {
-			std::vector<Pizza> menu = std::move(db->getPizzasAvailable());
+			SnapshotReader<std::vector<Pizza>> catalogue = db->getPizzasAvailable();
+			const std::vector<Pizza>& menu = *catalogue;
 			for (int i = 0; i < menu.size(); i++) {
 				std::cout << i + 1 << " " << menu[i].getPizzaType() << " " << menu[i].getPrice() << std::endl;
 			}
@@ -770,15 +3826,15 @@ void Admin::MainMenu(std::shared_ptr<PizzeriaDB> db) {
 			db->deletePizza(s);
 			break;
 		case 4: {
-			std::vector<PizzaMaker> workers = std::move(db->getPizzaMakers());
-			for (PizzaMaker e : workers) {
+			SnapshotReader<std::vector<PizzaMaker>> workers = db->getPizzaMakers();
+			for (const PizzaMaker& e : *workers) {
 				std::cout << e.getName() << std::endl;
 			}
 			break;
 		}
 		case 5: {
-			std::vector<DeliveryMan> workers = std::move(db->getCouriers());
-			for (DeliveryMan e : workers) {
+			SnapshotReader<std::vector<DeliveryMan>> workers = db->getCouriers();
+			for (const DeliveryMan& e : *workers) {
 				std::cout << e.getName() << std::endl;
 			}
 			break;
@@ -799,6 +3855,30 @@ void Admin::MainMenu(std::shared_ptr<PizzeriaDB> db) {
 			db->setAdminKey(s);
 			break;
 		case 9:
+			std::cout << "Primary journal position: " << db->getJournal().getLastSeq() << std::endl;
+			std::cout << "Replica applied position: " << replica->getAppliedSeq() << std::endl;
+			std::cout << "Replication lag: " << replica->getLag() << " records" << std::endl;
+			std::cout << "Snapshot reloads: " << replica->getSnapshotReloads() << std::endl;
+			break;
+		case 10:
+			db->printDeliveryReport();
+			break;
+		case 11: {
+			db->printAdmissionSettings();
+			std::cout << "Change budgets? y/n" << std::endl;
+			char c;
+			std::cin >> c;
+			if (c == 'y') {
+				int budget = inputInt("Latency budget in minutes", 1, 600);
+				int defer = inputInt("Defer orders up to, minutes", budget, 600);
+				db->setAdmissionBudgets(budget, defer);
+			}
+			break;
+		}
+		case 12:
+			db->printKitchenReport();
+			break;
+		case 13:
 			return;
 			break;
 		}
@@ -844,7 +3924,7 @@ int inputInt(const std::string& prompt, int m, int M) {
 	}
 }
 
-std::shared_ptr<User> authorisation(std::shared_ptr<PizzeriaDB> db) {
+std::shared_ptr<User> authorisation(std::shared_ptr<PizzeriaDB> db, std::shared_ptr<PizzeriaReplica> replica) {
 	int num;
 	while (true) {
 		num = inputInt("1 - I'm admin\n2 - I'm user\n3 - Exit\n", 1, 3);
@@ -852,7 +3932,7 @@ std::shared_ptr<User> authorisation(std::shared_ptr<PizzeriaDB> db) {
 			std::string s;
 			std::cout << "Enter admin access key: ";
 			std::cin >> s;
-			if (db->AdminIsValid(s)) return std::make_shared<Admin>();
+			if (db->AdminIsValid(s)) return std::make_shared<Admin>(replica);
 			else {
 				system("CLS");
 				std::cout << "Wrong key" << std::endl;
@@ -867,7 +3947,7 @@ std::shared_ptr<User> authorisation(std::shared_ptr<PizzeriaDB> db) {
 				std::cout << "Enter password: ";
 				std::cin >> p;
 				db->addClient(l, p);
-				return std::make_shared<Client>();
+				return std::make_shared<Client>(l, "Unknown", replica);
 			}
 			else {
 				std::string l, p;
@@ -875,8 +3955,8 @@ std::shared_ptr<User> authorisation(std::shared_ptr<PizzeriaDB> db) {
 				std::cin >> l;
 				std::cout << "Enter password: ";
 				std::cin >> p;
-				if (db->ClientIsValid(l, p)) {
-					 return std::make_shared<Client>(l, db->getClientAddress(l));
+				if (replica->ClientIsValid(l, p)) {
+					 return std::make_shared<Client>(l, replica->getClientAddress(l), replica);
 				}
 				else {
 					system("CLS");